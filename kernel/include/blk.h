@@ -0,0 +1,64 @@
+#ifndef __BLK_H__
+#define __BLK_H__
+
+#include "klib.h"
+#include "disk.h"
+
+// RAMDISK_ROOT, the size in MiB of a RAM disk the fs is copied to and
+// mounted from, comes from make RAMDISK=<MiB>; ROOT_DEV, the name of the
+// device to mount instead of the default one, e.g. ide0p1 for the first
+// MBR partition of the boot disk, from make ROOT=<name>
+
+// One block request waiting in a device's scheduler queue
+typedef struct bio {
+  uint32_t no;
+  void *buf;
+  int write;
+  int err;
+  uint32_t expire; // tick after which a write is served before reads
+  struct bio *next;
+} bio_t;
+
+// Common interface of block device backends, all ranges are in BLK_SIZE blocks
+typedef struct blkdev blkdev_t;
+
+struct blkdev {
+  char name[16];
+  uint32_t nblk; // capacity
+  int qdepth;    // max requests the backend takes at once
+  int irq;       // -1 if the backend never interrupts
+  int (*read)(blkdev_t *dev, void *buf, uint32_t no, uint32_t cnt);
+  int (*write)(blkdev_t *dev, const void *buf, uint32_t no, uint32_t cnt);
+  int (*flush)(blkdev_t *dev); // make finished writes durable
+  void (*intr)(blkdev_t *dev);
+  void *priv;
+  // elevator state, both queues sorted by block no
+  bio_t *rq, *wq;
+  uint32_t queued; // bios in rq and wq
+  uint32_t head; // block after the last transfer
+  struct iostat stat;
+};
+
+void init_blk();
+blkdev_t *blk_root();
+blkdev_t *blk_get(const char *name); // NULL if there is no such device
+void blk_register(blkdev_t *dev);
+int blk_read(blkdev_t *dev, void *buf, uint32_t no, uint32_t cnt);
+int blk_write(blkdev_t *dev, const void *buf, uint32_t no, uint32_t cnt);
+int blk_flush(blkdev_t *dev);
+void blk_intr(int irq);
+int blk_stat(int id, struct iostat *st);
+
+// I/O batching, requests are sorted and merged until the device is unplugged
+void blk_submit(blkdev_t *dev, bio_t *bio);
+void blk_unplug(blkdev_t *dev);
+
+// backends, probes return NULL if the device is absent
+int ide_probe(blkdev_t *devs[]); // fills devs, returns how many
+blkdev_t *virtio_probe();
+blkdev_t *ramdisk_create(uint32_t nblk);
+blkdev_t *partition_create(blkdev_t *parent, uint32_t start, uint32_t nblk, int idx);
+void partition_probe(blkdev_t *dev); // one partition_create per MBR entry
+blkdev_t *raid0_assemble(blkdev_t *devs[], int n); // NULL if no complete array
+
+#endif
@@ -12,8 +12,36 @@ void copy_to_disk(const void *buf, int nbytes, int disk_offset);
 
 #define BLK_SIZE (SECTSIZE * 8)
 
+// block nos from BDELAY up name cache-only blocks, file data that has no
+// disk block yet; they stay in the cache until bmove or bdrop
+#define BDELAY 0x80000000u
+#define BDELAY_NBUF 96 // most cache-only blocks at once, the fs keeps under it
+
+struct blkdev;
+void bmount(struct blkdev *dev);
 void bread(void *dst, uint32_t size, uint32_t no, uint32_t off);
 void bwrite(const void *src, uint32_t size, uint32_t no, uint32_t off);
+void bread_run(void *dst, uint32_t no, uint32_t cnt);
+void bwrite_run(const void *src, uint32_t no, uint32_t cnt);
+void bcopy(uint32_t to, uint32_t toff, uint32_t from, uint32_t foff, uint32_t size);
+void bread_direct(void *dst, uint32_t no, uint32_t cnt);
+void bwrite_direct(const void *src, uint32_t no, uint32_t cnt);
 void bzero(uint32_t no);
+void bmove(uint32_t from, uint32_t to);
+void bdrop(uint32_t no);
+void bsync();
+
+struct buf;
+struct buf *bpage(uint32_t no, void *owner, uint32_t idx);
+struct buf *btag(uint32_t no, void *owner, uint32_t idx);
+void bforget(uint32_t no);
+int bpage_is(struct buf *b, void *owner, uint32_t idx);
+void bpage_read(struct buf *b, void *dst, uint32_t size, uint32_t off);
+void bpage_write(struct buf *b, const void *src, uint32_t size, uint32_t off);
+void *bpage_map(struct buf *b);
+int bunmap(void *frame, int dirty);
+void log_mount(uint32_t start, uint32_t size);
+void log_begin();
+void log_end(int commit);
 
 #endif
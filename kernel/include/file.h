@@ -13,6 +13,7 @@ typedef struct file {//The map table of proc with its files!
   // for normal file
   inode_t *inode;
   uint32_t offset;
+  int direct; // O_DIRECT
 
   // for dev file
   dev_t *dev_op;
@@ -21,7 +22,17 @@ typedef struct file {//The map table of proc with its files!
 file_t *fopen(const char *path, int mode);
 int fread(file_t *file, void *buf, uint32_t size);
 int fwrite(file_t *file, const void *buf, uint32_t size);
+int fpread(file_t *file, void *buf, uint32_t size, uint32_t off);
+int fpwrite(file_t *file, const void *buf, uint32_t size, uint32_t off);
+int freadv(file_t *file, const struct iovec *iov, int cnt);
+int fwritev(file_t *file, const struct iovec *iov, int cnt);
+int fsendfile(file_t *out, file_t *in, uint32_t *off, uint32_t len);
+int fcopy_range(file_t *in, uint32_t *off_in, file_t *out, uint32_t *off_out, uint32_t len);
 uint32_t fseek(file_t *file, uint32_t off, int whence);
+int fsync(file_t *file);
+int ftruncate(file_t *file, uint32_t len);
+int fallocate(file_t *file, uint32_t off, uint32_t len);
+int fgetdents(file_t *file, struct dirstat *buf, uint32_t size);
 file_t *fdup(file_t *file);
 void fclose(file_t *file);
 
@@ -3,31 +3,41 @@
 
 #include <stdint.h>
 
+// Files as the rest of the kernel sees them, whatever fs they are on;
+// the VFS in vfs.c finds the fs of each and passes the call on
 typedef struct inode inode_t;
-
-//#define EASY_FS // TODO: comment me at Lab3-2
+struct dirstat;
+struct stat;
+struct iovec;
 
 void init_fs();
 
 inode_t *iopen(const char *path, int type);
 int iread(inode_t *inode, uint32_t off, void *buf, uint32_t len);
 int iwrite(inode_t *inode, uint32_t off, const void *buf, uint32_t len);
+int ireadv(inode_t *inode, uint32_t off, const struct iovec *iov, int cnt);
+int iwritev(inode_t *inode, uint32_t off, const struct iovec *iov, int cnt);
+int iread_direct(inode_t *inode, uint32_t off, void *buf, uint32_t len);
+int iwrite_direct(inode_t *inode, uint32_t off, const void *buf, uint32_t len);
+int icopy(inode_t *dst, uint32_t doff, inode_t *src, uint32_t soff, uint32_t len);
+void *imap_page(inode_t *inode, uint32_t idx);
+int iunmap_page(inode_t *inode, void *frame, int dirty);
 void itrunc(inode_t *inode);
+int itruncate(inode_t *inode, uint32_t len);
+int iallocate(inode_t *inode, uint32_t off, uint32_t len);
+void isync(inode_t *inode);
 inode_t *idup(inode_t *inode);
 void iclose(inode_t *inode);
 uint32_t isize(inode_t *inode);
 int itype(inode_t *inode);
 uint32_t ino(inode_t *inode);
 int idevid(inode_t *inode);
-void iadddev(const char *name, int id);
+int idirread(inode_t *dir, uint32_t *off, struct dirstat *ds, int n);
+void ifstat(inode_t *inode, struct stat *st);
+void ifextents(inode_t *inode, struct stat *st); // as ifstat, but may walk the whole file
+int istat(inode_t *at, const char *path, struct stat *st);
 int iremove(const char *path);
 
-#ifdef EASY_FS
-
-#define MAX_NAME  (31 - 2 * sizeof(uint32_t))
-
-#else
-
 #define MAX_NAME  (31 - sizeof(uint32_t))
 
 typedef struct dirent {
@@ -36,5 +46,3 @@ typedef struct dirent {
 } dirent_t;
 
 #endif
-
-#endif
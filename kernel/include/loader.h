@@ -3,9 +3,12 @@
 
 #include <stdint.h>
 
-uint32_t load_elf(struct PageDirectory *pgdir, const char *name);
+struct vma;
+
+// the image's read-only pages are private mappings of the file, put in vmas
+uint32_t load_elf(struct PageDirectory *pgdir, const char *name, struct vma *vmas);
 uint32_t load_arg(struct PageDirectory *pgdir, char *const argv[]);
 int load_user(struct PageDirectory *pgdir, struct Context *ctx, 
-              const char *name, char *const argv[]);
+              const char *name, char *const argv[], struct vma *vmas);
 
 #endif
@@ -0,0 +1,25 @@
+#ifndef __PCI_H__
+#define __PCI_H__
+
+#include <stdint.h>
+
+#define PCI_VENDOR   0x00
+#define PCI_COMMAND  0x04
+#define PCI_BAR0     0x10
+#define PCI_INTLINE  0x3c
+
+#define PCI_CMD_IO     0x1
+#define PCI_CMD_MEM    0x2
+#define PCI_CMD_MASTER 0x4
+
+typedef struct pci_dev {
+  int bus, slot, func;
+  uint16_t vendor, device;
+  int irq; // legacy INTx line routed by the BIOS
+} pci_dev_t;
+
+uint32_t pci_read(pci_dev_t *dev, int reg);
+void pci_write(pci_dev_t *dev, int reg, uint32_t val);
+int pci_find(uint16_t vendor, uint16_t device, int index, pci_dev_t *dev);
+
+#endif
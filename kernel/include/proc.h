@@ -20,6 +20,21 @@ typedef union {
 #define STACK_TOP(kstack) (&((kstack)->stack[KSTACK_SIZE]))
 #define MAX_USEM 32
 #define MAX_UFILE 32
+#define MAX_VMA 16
+
+#define MMAP_BASE 0x80000000 // mappings go in [MMAP_BASE, MMAP_TOP), above the heap
+#define MMAP_TOP  0xb0000000
+
+// a mmap'ed range or a read-only part of the exec'd image, its pages come
+// in on the first fault
+typedef struct vma {
+  size_t start, len; // page aligned, len is 0 if the slot is free
+  int prot, flags;
+  file_t *file; // NULL if anonymous
+  uint32_t off; // where start is in the file
+} vma_t;
+
+typedef struct ioring ioring_t;
 
 typedef struct proc {
   int pid;
@@ -35,6 +50,9 @@ typedef struct proc {
   usem_t *usems[MAX_USEM]; // Lab2-5
   file_t *files[MAX_UFILE]; // Lab3-1
   inode_t *cwd; // Lab3-2
+  vma_t vmas[MAX_VMA];
+  ioring_t *ring; // of the proc, or the one a kernel thread serves
+  struct proc *owner; // a kernel thread runs in the memory of its owner
 } proc_t; 
 
 void init_proc();
@@ -48,6 +66,8 @@ void proc_copycurr(proc_t *proc);
 void proc_makezombie(proc_t *proc, int exitcode);
 proc_t *proc_findzombie(proc_t *proc);
 void proc_block();
+proc_t *proc_kthread(proc_t *owner, void (*entry)());
+void proc_kexit() __attribute__((noreturn));
 int proc_allocusem(proc_t *proc);
 usem_t *proc_getusem(proc_t *proc, int sem_id);
 int proc_allocfile(proc_t *proc);
@@ -55,4 +75,18 @@ file_t *proc_getfile(proc_t *proc, int fd);
 
 void schedule(Context *ctx);
 
+// memory mapped files and anonymous memory, in mmap.c
+size_t mmap_map(proc_t *proc, size_t addr, size_t len, int prot, int flags, file_t *file, uint32_t off);
+int mmap_unmap(proc_t *proc, size_t addr, size_t len);
+void mmap_unmapall(proc_t *proc);
+int mmap_image(PD *pgdir, vma_t *vmas, size_t start, size_t len, file_t *file, uint32_t off);
+int mmap_covers(proc_t *proc, size_t va);
+void mmap_dup(proc_t *dst, proc_t *src);
+int mmap_fault(size_t va, int errcode);
+
+// submission and completion rings, in ioring.c
+int ioring_setup(proc_t *proc, struct io_ring *u);
+int ioring_enter(proc_t *proc, int min_complete);
+void ioring_close(proc_t *proc);
+
 #endif
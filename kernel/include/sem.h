@@ -12,6 +12,17 @@ void sem_init(sem_t *sem, int value);
 void sem_p(sem_t *sem);
 void sem_v(sem_t *sem);
 
+// A sleep lock its holder may take again, for entry points that nest
+typedef struct rlock {
+  sem_t sem;
+  void *owner; // proc holding it
+  int depth;
+} rlock_t;
+
+void rlock_init(rlock_t *lk);
+void rlock_acquire(rlock_t *lk);
+void rlock_release(rlock_t *lk);
+
 typedef struct usem {
   sem_t sem;
   int ref;
@@ -6,5 +6,6 @@
 void init_timer();
 void timer_handle();
 uint32_t get_tick();
+uint32_t get_time(); // seconds since the Unix epoch
 
 #endif
@@ -0,0 +1,50 @@
+#ifndef __VFS_H__
+#define __VFS_H__
+
+#include "fs.h"
+
+// What a file system gives the VFS. Its nodes are opaque here, mount and
+// lookup hand out a ref to one that close drops. lookup creates name as
+// type if it is missing and type is not TYPE_NONE. The entries after
+// dirread are fast paths, NULL if the fs has none; the VFS then falls
+// back on read and write.
+typedef struct fsops {
+  const char *name;
+  void *(*mount)(void *src); // the root, NULL if src holds no such fs
+  void *(*lookup)(void *dir, const char *name, int type);
+  void *(*dup)(void *node);
+  void (*close)(void *node);
+  int (*type)(void *node);
+  uint32_t (*no)(void *node);
+  uint32_t (*size)(void *node);
+  int (*devid)(void *node);
+  int (*read)(void *node, uint32_t off, void *buf, uint32_t len);
+  int (*write)(void *node, uint32_t off, const void *buf, uint32_t len);
+  void (*trunc)(void *node);
+  int (*remove)(void *dir, const char *name);
+  void (*stat)(void *node, struct stat *st);
+  void (*extents)(void *node, struct stat *st); // as stat, with every run counted
+  int (*dirread)(void *dir, uint32_t *off, struct dirstat *ds, int n);
+  int (*readv)(void *node, uint32_t off, const struct iovec *iov, int cnt);
+  int (*writev)(void *node, uint32_t off, const struct iovec *iov, int cnt);
+  int (*read_direct)(void *node, uint32_t off, void *buf, uint32_t len); // around its cache
+  int (*write_direct)(void *node, uint32_t off, const void *buf, uint32_t len);
+  int (*copy)(void *dst, uint32_t doff, void *src, uint32_t soff, uint32_t len); // both on this fs
+  void *(*map_page)(void *node, uint32_t idx);
+  int (*unmap_page)(void *node, void *frame, int dirty);
+  void (*sync)(void *node); // what was written is durable once it returns
+  int (*truncate)(void *node, uint32_t len); // to any size, a hole if it grows
+  int (*allocate)(void *node, uint32_t off, uint32_t len); // -1 if out of space
+} fsops_t;
+
+extern const fsops_t diskfs_ops, tmpfs_ops, devfs_ops;
+
+int vfs_mount(const char *path, const fsops_t *ops, void *src);
+void vfs_lock(); // what an fs holds across its ops, see vfs.c
+void vfs_unlock();
+int vfs_dirents(const fsops_t *ops, void *dir, uint32_t off, void *buf, uint32_t len);
+
+void init_tmpfs();
+void devfs_add(const char *name, int id);
+
+#endif
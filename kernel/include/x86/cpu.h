@@ -53,6 +53,13 @@ static inline void pause() {
   asm volatile ("pause");
 }
 
+// index of the lowest set bit, x must not be 0
+static inline int bsf(uint32_t x) {
+  int idx;
+  asm ("bsf %1, %0" : "=r"(idx) : "rm"(x));
+  return idx;
+}
+
 static inline uint32_t get_efl() {
   volatile uintptr_t efl;
   asm volatile ("pushf; pop %0": "=r"(efl));
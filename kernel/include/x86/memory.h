@@ -17,6 +17,7 @@
 
 // Control Register flags
 #define CR0_PE         0x00000001  // Protection Enable
+#define CR0_WP         0x00010000  // Write Protect, also for the kernel
 #define CR0_PG         0x80000000  // Paging
 
 // Page table/directory entry flags
@@ -0,0 +1,202 @@
+#include "klib.h"
+#include "blk.h"
+#include "vme.h"
+
+#define MAX_BLKDEV 16
+
+static blkdev_t *blkdevs[MAX_BLKDEV];
+static int nr_blkdev;
+static blkdev_t *root;
+
+void blk_register(blkdev_t *dev) {
+  assert(nr_blkdev < MAX_BLKDEV);
+  blkdevs[nr_blkdev++] = dev;
+  printf("blk: %s, %d blocks, queue depth %d\n", dev->name, dev->nblk, dev->qdepth);
+}
+
+void init_blk() {
+  blkdev_t *devs[MAX_BLKDEV];
+  int n = ide_probe(devs);
+  blkdev_t *vd = virtio_probe();
+  if (vd) devs[n++] = vd;
+  panic_on(n == 0, "no block device");
+  for (int i = 0; i < n; ++i) {
+    blk_register(devs[i]);
+  }
+  for (int i = 0; i < n; ++i) {
+    partition_probe(devs[i]);
+  }
+  // a striped array wins, then virtio-blk when QEMU provides one, then
+  // the ATA disk the kernel was booted from
+  root = raid0_assemble(devs, n);
+  if (root == NULL) root = vd;
+  if (root == NULL) root = devs[0];
+#ifdef ROOT_DEV
+  root = blk_get(ROOT_DEV);
+  panic_on(root == NULL, "no root device " ROOT_DEV);
+#endif
+#ifdef RAMDISK_ROOT
+  // copy the head of the disk, the fs refuses to mount if it doesn't fit
+  blkdev_t *rd = ramdisk_create(RAMDISK_ROOT * 1024 * 1024 / BLK_SIZE);
+  uint32_t nblk = MIN(rd->nblk, root->nblk);
+  for (uint32_t i = 0; i < nblk; ++i) {
+    assert(blk_read(root, ((void**)rd->priv)[i], i, 1) == 0);
+  }
+  root = rd;
+#endif
+  printf("blk: root device is %s\n", root->name);
+}
+
+blkdev_t *blk_root() {
+  return root;
+}
+
+blkdev_t *blk_get(const char *name) {
+  for (int i = 0; i < nr_blkdev; ++i) {
+    if (strcmp(blkdevs[i]->name, name) == 0) return blkdevs[i];
+  }
+  return NULL;
+}
+
+int blk_read(blkdev_t *dev, void *buf, uint32_t no, uint32_t cnt) {
+  if (no + cnt > dev->nblk) return -1;
+  return dev->read(dev, buf, no, cnt);
+}
+
+int blk_write(blkdev_t *dev, const void *buf, uint32_t no, uint32_t cnt) {
+  if (no + cnt > dev->nblk) return -1;
+  return dev->write(dev, buf, no, cnt);
+}
+
+int blk_flush(blkdev_t *dev) {
+  return dev->flush ? dev->flush(dev) : 0;
+}
+
+int blk_stat(int id, struct iostat *st) {
+  if (id < 0 || id >= nr_blkdev) return -1;
+  blkdev_t *dev = blkdevs[id];
+  *st = dev->stat;
+  strcpy(st->name, dev->name);
+  st->nblk = dev->nblk;
+  return 0;
+}
+
+void blk_intr(int irq) {
+  for (int i = 0; i < nr_blkdev; ++i) {
+    if (blkdevs[i]->irq == irq && blkdevs[i]->intr) {
+      blkdevs[i]->intr(blkdevs[i]);
+    }
+  }
+}
+
+// RAM disk, one kalloc'ed page per block
+
+#define RAMDISK_MAXBLK 16384 // 64 MiB
+
+static void *rd_pages[RAMDISK_MAXBLK];
+
+static int ramdisk_read(blkdev_t *dev, void *buf, uint32_t no, uint32_t cnt) {
+  void **pages = dev->priv;
+  for (uint32_t i = 0; i < cnt; ++i) {
+    memcpy(buf + i * BLK_SIZE, pages[no + i], BLK_SIZE);
+  }
+  return 0;
+}
+
+static int ramdisk_write(blkdev_t *dev, const void *buf, uint32_t no, uint32_t cnt) {
+  void **pages = dev->priv;
+  for (uint32_t i = 0; i < cnt; ++i) {
+    memcpy(pages[no + i], buf + i * BLK_SIZE, BLK_SIZE);
+  }
+  return 0;
+}
+
+static blkdev_t ramdisk_dev = {
+  .name = "ram0",
+  .qdepth = 1,
+  .irq = -1,
+  .read = ramdisk_read,
+  .write = ramdisk_write,
+};
+
+blkdev_t *ramdisk_create(uint32_t nblk) {
+  assert(ramdisk_dev.nblk == 0); // only one RAM disk
+  assert(nblk <= RAMDISK_MAXBLK && BLK_SIZE == PGSIZE);
+  for (uint32_t i = 0; i < nblk; ++i) {
+    rd_pages[i] = kalloc();
+  }
+  ramdisk_dev.nblk = nblk;
+  ramdisk_dev.priv = rd_pages;
+  blk_register(&ramdisk_dev);
+  return &ramdisk_dev;
+}
+
+// Partition, a window [start, start+nblk) of its parent
+
+#define MAX_PART 8
+
+typedef struct {
+  blkdev_t dev;
+  blkdev_t *parent;
+  uint32_t start;
+} part_t;
+
+static part_t parts[MAX_PART];
+static int nr_part;
+
+static int part_read(blkdev_t *dev, void *buf, uint32_t no, uint32_t cnt) {
+  part_t *p = dev->priv;
+  return blk_read(p->parent, buf, p->start + no, cnt);
+}
+
+static int part_write(blkdev_t *dev, const void *buf, uint32_t no, uint32_t cnt) {
+  part_t *p = dev->priv;
+  return blk_write(p->parent, buf, p->start + no, cnt);
+}
+
+static int part_flush(blkdev_t *dev) {
+  part_t *p = dev->priv;
+  return blk_flush(p->parent);
+}
+
+blkdev_t *partition_create(blkdev_t *parent, uint32_t start, uint32_t nblk, int idx) {
+  if (nr_part >= MAX_PART || start + nblk < start || start + nblk > parent->nblk) return NULL;
+  part_t *p = &parts[nr_part++];
+  p->parent = parent;
+  p->start = start;
+  sprintf(p->dev.name, "%sp%d", parent->name, idx);
+  p->dev.nblk = nblk;
+  p->dev.qdepth = parent->qdepth;
+  p->dev.irq = -1; // completions come from the parent
+  p->dev.read = part_read;
+  p->dev.write = part_write;
+  p->dev.flush = part_flush;
+  p->dev.priv = p;
+  blk_register(&p->dev);
+  return &p->dev;
+}
+
+// MBR: four 16-byte entries from byte 446 on, 0x55 0xaa at byte 510
+
+#define MBR_TABLE 446
+#define SECT_PER_BLK (BLK_SIZE / SECTSIZE)
+
+struct mbr_entry {
+  uint8_t status, chs_first[3], type, chs_last[3];
+  uint32_t lba, nsect;
+} __attribute__((packed));
+
+static uint8_t mbr[BLK_SIZE];
+
+void partition_probe(blkdev_t *dev) {
+  if (dev->nblk == 0 || blk_read(dev, mbr, 0, 1) != 0) return;
+  if (mbr[510] != 0x55 || mbr[511] != 0xaa) return;
+  struct mbr_entry *e = (struct mbr_entry *)&mbr[MBR_TABLE];
+  for (int i = 0; i < 4; ++i, ++e) {
+    // a block holds several sectors, one that starts mid-block is skipped
+    if (e->type == 0 || e->nsect < SECT_PER_BLK || e->lba % SECT_PER_BLK) continue;
+    if (partition_create(dev, e->lba / SECT_PER_BLK, e->nsect / SECT_PER_BLK, i + 1) == NULL) {
+      printf("blk: %s partition %d out of range\n", dev->name, i + 1);
+    }
+  }
+}
@@ -4,6 +4,7 @@
 #include "serial.h"
 #include "timer.h"
 #include "proc.h"
+#include "blk.h"
 
 static GateDesc32 idt[NR_IRQ];
 
@@ -118,6 +119,7 @@ void irq_handle(Context *ctx) {
   // TODO: Lab2-1 handle yield
   case 0x81: schedule(ctx); break;//call yield!
   default: assert(ctx->irq >= T_IRQ0 && ctx->irq < T_IRQ0 + NR_INTR);
+           blk_intr(ctx->irq - T_IRQ0); // disk irq lines are probed at boot
   }
   irq_iret(ctx);
 }
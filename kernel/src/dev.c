@@ -1,7 +1,7 @@
 #include "klib.h"
 #include "dev.h"
 #include "serial.h"
-#include "fs.h"
+#include "vfs.h"
 
 static int ban_read(void *buf, size_t count) {
   return -1;
@@ -15,16 +15,16 @@ static struct {
   char name[32];
   dev_t dev_op;
 } dev_table[] = {
-  {"/dev/serial", {serial_read, serial_write}},
-  {"/dev/null", {ban_read, ignore_write}}
+  {"serial", {serial_read, serial_write}},
+  {"null", {ban_read, ignore_write}}
 };
 
 #define DEV_NUM (sizeof(dev_table) / sizeof(dev_table[0]))
 
 void init_dev() {
-  iclose(iopen("/dev", TYPE_DIR)); // create the dev dir
+  assert(vfs_mount("/dev", &devfs_ops, NULL) == 0);
   for (int i = 0; i < DEV_NUM; ++i) {
-    iadddev(dev_table[i].name, i);
+    devfs_add(dev_table[i].name, i);
   }
 }
 
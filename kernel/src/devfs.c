@@ -0,0 +1,111 @@
+#include "klib.h"
+#include "vfs.h"
+
+// The devices as a dir in memory, mounted on /dev. A node is the root or
+// an entry of devs, neither ever freed, so refs need no counting.
+
+#define MAX_DEV 16
+
+static struct devnode {
+  char name[MAX_NAME + 1];
+  int id;
+} devs[MAX_DEV];
+static int ndev;
+static char droot; // the root is only its address
+
+void devfs_add(const char *name, int id) {
+  assert(ndev < MAX_DEV && strlen(name) <= MAX_NAME);
+  strcpy(devs[ndev].name, name);
+  devs[ndev++].id = id;
+}
+
+static void *dev_mount(void *src) {
+  return &droot;
+}
+
+static void *dev_lookup(void *dir, const char *name, int type) {
+  // devices come from devfs_add only
+  if (dir != &droot) return NULL;
+  if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return &droot;
+  for (int i = 0; i < ndev; ++i) {
+    if (strcmp(devs[i].name, name) == 0) return &devs[i];
+  }
+  return NULL;
+}
+
+static void *dev_dup(void *node) {
+  return node;
+}
+
+static void dev_close(void *node) {
+}
+
+static int dev_type(void *node) {
+  return node == &droot ? TYPE_DIR : TYPE_DEV;
+}
+
+static uint32_t dev_no(void *node) {
+  return 0;
+}
+
+static uint32_t dev_size(void *node) {
+  // the root reads as the dirents of . and .. and the devices
+  return node == &droot ? (ndev + 2) * sizeof(dirent_t) : 0;
+}
+
+static int dev_devid(void *node) {
+  return node == &droot ? -1 : ((struct devnode *)node)->id;
+}
+
+// the data of a device goes through dev_get, never through here
+static int dev_read(void *node, uint32_t off, void *buf, uint32_t len) {
+  if (node != &droot) return -1;
+  return vfs_dirents(&devfs_ops, node, off, buf, len);
+}
+
+static int dev_write(void *node, uint32_t off, const void *buf, uint32_t len) {
+  return -1;
+}
+
+static void dev_trunc(void *node) {
+}
+
+static int dev_remove(void *dir, const char *name) {
+  return -1;
+}
+
+static void dev_stat(void *node, struct stat *st) {
+  memset(st, 0, sizeof(*st));
+  st->type = dev_type(node);
+  st->size = dev_size(node);
+}
+
+static int dev_dirread(void *dir, uint32_t *off, struct dirstat *ds, int n) {
+  if (dir != &droot) return -1;
+  int cnt = 0;
+  for (; cnt < n && *off < ndev + 2; ++cnt, ++*off) {
+    ds[cnt].type = *off < 2 ? TYPE_DIR : TYPE_DEV;
+    ds[cnt].node = 0;
+    ds[cnt].size = *off < 2 ? dev_size(&droot) : 0;
+    strcpy(ds[cnt].name, *off == 0 ? "." : *off == 1 ? ".." : devs[*off - 2].name);
+  }
+  return cnt;
+}
+
+const fsops_t devfs_ops = {
+  .name = "devfs",
+  .mount = dev_mount,
+  .lookup = dev_lookup,
+  .dup = dev_dup,
+  .close = dev_close,
+  .type = dev_type,
+  .no = dev_no,
+  .size = dev_size,
+  .devid = dev_devid,
+  .read = dev_read,
+  .write = dev_write,
+  .trunc = dev_trunc,
+  .remove = dev_remove,
+  .stat = dev_stat,
+  .dirread = dev_dirread,
+};
@@ -1,36 +1,23 @@
 #include "klib.h"
 #include "disk.h"
+#include "blk.h"
+#include "vme.h"
 
-static inline void wait_disk() {
-  while ((inb(0x1f7) & 0xc0) != 0x40);
-}
+// Sector interface, backed by the root block device
+
+static uint8_t sect_buf[BLK_SIZE];
+
+#define SECT_PER_BLK (BLK_SIZE / SECTSIZE)
 
 void read_disk(void *buf, int sect) {
-  wait_disk();
-  outb(0x1f2, 1);
-  outb(0x1f3, sect);
-  outb(0x1f4, sect >> 8);
-  outb(0x1f5, sect >> 16);
-  outb(0x1f6, (sect >> 24) | 0xE0);
-  outb(0x1f7, 0x20);
-  wait_disk();
-  for (int i = 0; i < SECTSIZE / 4; i ++) {
-    ((uint32_t *)buf)[i] = inl(0x1f0);
-  }
+  assert(blk_read(blk_root(), sect_buf, sect / SECT_PER_BLK, 1) == 0);
+  memcpy(buf, &sect_buf[(sect % SECT_PER_BLK) * SECTSIZE], SECTSIZE);
 }
 
 void write_disk(const void *buf, int sect) {
-  wait_disk();
-  outb(0x1f2, 1);
-  outb(0x1f3, sect);
-  outb(0x1f4, sect >> 8);
-  outb(0x1f5, sect >> 16);
-  outb(0x1f6, (sect >> 24) | 0xE0);
-  outb(0x1f7, 0x30);
-  wait_disk();
-  for (int i = 0; i < SECTSIZE / 4; i ++) {
-    outl(0x1f0, ((uint32_t *)buf)[i]);
-  }
+  assert(blk_read(blk_root(), sect_buf, sect / SECT_PER_BLK, 1) == 0);
+  memcpy(&sect_buf[(sect % SECT_PER_BLK) * SECTSIZE], buf, SECTSIZE);
+  assert(blk_write(blk_root(), sect_buf, sect / SECT_PER_BLK, 1) == 0);
 }
 
 void copy_from_disk(void *buf, int nbytes, int disk_offset) {
@@ -49,42 +36,576 @@ void copy_to_disk(const void *buf, int nbytes, int disk_offset) {
     write_disk((const void *)cur, sect);
 }
 
-#define BCACHE_NUM 16
+// Buffer cache: NBUF blocks hashed by block no and kept in LRU order.
+// Writes only dirty the buffer, dirty blocks go out through the elevator
+// in one batch so neighbouring blocks merge. Inside an fs op bwrite logs
+// the block instead, see the redo log below.
+
+#define NBUF      320
+#define NHASH     61
+#define READAHEAD 8 // blocks fetched on a sequential miss
+
+typedef struct buf {
+  uint32_t no;
+  int valid, dirty;
+  int logged; // in the running log group, pinned until it commits
+  int mapped; // user mappings of data, pinned while there are any
+  void *owner; // inode whose page idx this block holds, see bpage
+  uint32_t idx;
+  uint8_t *data;
+  bio_t bio;
+  struct buf *hnext;
+  struct buf *prev, *next; // LRU list, most recent first
+} buf_t;
 
-typedef struct {
-  int valid, no;
-  uint8_t buf[BLK_SIZE];
-} bcache_t;
+static buf_t bufs[NBUF];
+static buf_t *bhash[NHASH];
+static buf_t lru;
+static int ndirty;
+static int nmapped; // buffers with mappings
+static uint32_t last_miss = -1;
+static blkdev_t *bdev; // device the cache sits on
 
-static bcache_t blk_cache[BCACHE_NUM];
+// Redo log: the header block at start names the home of each block in
+// the size - 1 blocks after it. Ops between log_begin and log_end form a
+// group that bsync commits. The ordered data goes home first. Then the
+// header and the log copies go out as one sequential write, and the
+// blocks go home after it. Once they are there, the header is cleared,
+// so the group never replays over writes made after it. The header
+// checksums its group, so a torn commit is ignored and mount replays
+// the last whole group.
+#define LOG_MAX 126 // blocks a header names
+#define LOG_OP  80  // most blocks one op logs, an index build takes 70
 
-static bcache_t *bgetcache(uint32_t no) {
-  bcache_t *bc = &blk_cache[no % BCACHE_NUM];
-  if (bc->valid == 0 || bc->no != no) {
-    copy_from_disk(bc->buf, BLK_SIZE, no * BLK_SIZE);
-    bc->valid = 1;
-    bc->no = no;
+static struct {
+  uint32_t start, size; // size is 0 if the fs has no log
+  int depth, commit;
+  struct {
+    uint32_t n, sum;
+    uint32_t no[LOG_MAX];
+  } head;
+  buf_t *bufs[LOG_MAX];
+} blog;
+
+static void lru_remove(buf_t *b) {
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+}
+
+static void lru_push(buf_t *b) {
+  b->next = lru.next;
+  b->prev = &lru;
+  lru.next->prev = b;
+  lru.next = b;
+}
+
+static buf_t *blookup(uint32_t no) {
+  for (buf_t *b = bhash[no % NHASH]; b; b = b->hnext) {
+    if (b->no == no && b->valid >= 0) return b;
   }
-  return bc;
+  return NULL;
+}
+
+static void bunhash(buf_t *b) {
+  buf_t **pp = &bhash[b->no % NHASH];
+  while (*pp && *pp != b) pp = &(*pp)->hnext;
+  if (*pp) *pp = b->hnext;
+}
+
+void bmount(blkdev_t *dev) {
+  if (bdev) bsync();
+  lru.prev = lru.next = &lru;
+  memset(bhash, 0, sizeof(bhash));
+  for (int i = 0; i < NBUF; ++i) {
+    if (bufs[i].data == NULL) bufs[i].data = kalloc();
+    bufs[i].valid = -1; // not hashed
+    bufs[i].dirty = bufs[i].logged = bufs[i].mapped = 0;
+    bufs[i].owner = NULL;
+    lru_push(&bufs[i]);
+  }
+  bdev = dev;
+  nmapped = 0;
+  blog.size = blog.head.n = 0;
+}
+
+static void bwriteback();
+
+// find or recycle the buffer of block no, its data is valid only if b->valid
+static buf_t *bget(uint32_t no) {
+  buf_t *b = blookup(no);
+  if (b == NULL) {
+    b = lru.prev;
+    while (b->logged || b->mapped || b->no >= BDELAY) b = b->prev; // pinned
+    panic_on(b == &lru, "buffer cache pinned by the log");
+    if (b->dirty) bwriteback();
+    if (b->valid >= 0) bunhash(b);
+    b->owner = NULL;
+    b->no = no;
+    b->valid = 0;
+    b->hnext = bhash[no % NHASH];
+    bhash[no % NHASH] = b;
+  }
+  lru_remove(b);
+  lru_push(b);
+  return b;
+}
+
+static void bsubmit_read(buf_t *b) {
+  b->bio.no = b->no;
+  b->bio.buf = b->data;
+  b->bio.write = 0;
+  blk_submit(bdev, &b->bio);
+}
+
+static buf_t *bgetcache(uint32_t no) {
+  buf_t *b = bget(no);
+  if (!b->valid) {
+    buf_t *ra[READAHEAD];
+    int n = 0;
+    ra[n++] = b;
+    bsubmit_read(b);
+    if (no == last_miss + 1) {
+      // sequential, queue the following blocks too so they merge
+      for (uint32_t i = no + 1; n < READAHEAD && i < bdev->nblk; ++i) {
+        if (blookup(i)) break;
+        ra[n] = bget(i);
+        bsubmit_read(ra[n++]);
+      }
+    }
+    last_miss = no + n - 1;
+    blk_unplug(bdev);
+    for (int i = 0; i < n; ++i) {
+      assert(ra[i]->bio.err == 0);
+      ra[i]->valid = 1;
+    }
+  }
+  return b;
+}
+
+static void bdirty(buf_t *b) {
+  if (b->logged || b->no >= BDELAY) return; // goes out with its group, or has no home yet
+  if (!b->dirty) {
+    b->dirty = 1;
+    ndirty++;
+  }
+  if (ndirty > NBUF / 2) bwriteback();
+}
+
+static void blogged(buf_t *b) {
+  // a metadata write, joins the running group if there is one
+  if (blog.depth == 0 || blog.size == 0 || b->logged || b->no >= BDELAY) {
+    bdirty(b);
+    return;
+  }
+  panic_on(blog.head.n == blog.size - 1, "log group too large");
+  if (b->dirty) {
+    b->dirty = 0;
+    ndirty--;
+  }
+  b->logged = 1;
+  blog.bufs[blog.head.n++] = b;
 }
 
 void bread(void *dst, uint32_t size, uint32_t no, uint32_t off) {
   // read blk no's [off, off+size) to dst, promise off+size<=BLK_SIZE
   assert(size + off <= BLK_SIZE);
-  bcache_t *bc = bgetcache(no);
-  memcpy(dst, &bc->buf[off], size);
+  buf_t *b = bgetcache(no);
+  memcpy(dst, &b->data[off], size);
 }
 
 void bwrite(const void *src, uint32_t size, uint32_t no, uint32_t off) {
   // write src to blk no's [off, off+size), promise off+size<=BLK_SIZE
   assert(size + off <= BLK_SIZE);
-  bcache_t *bc = bgetcache(no);
-  memcpy(&bc->buf[off], src, size);
-  copy_to_disk(bc->buf, BLK_SIZE, no * BLK_SIZE);
+  buf_t *b = size == BLK_SIZE ? bget(no) : bgetcache(no);
+  memcpy(&b->data[off], src, size);
+  b->valid = 1;
+  blogged(b);
+}
+
+#define RUN_BATCH 32 // blocks of a run in the cache at once, well below NBUF
+
+void bread_run(void *dst, uint32_t no, uint32_t cnt) {
+  // read cnt whole blocks from no on, the misses go out as one batch
+  for (uint32_t i = 0; i < cnt; i += RUN_BATCH) {
+    uint32_t n = MIN(cnt - i, RUN_BATCH);
+    buf_t *run[RUN_BATCH + READAHEAD];
+    int miss = 0;
+    for (uint32_t j = 0; j < n; ++j) {
+      run[j] = bget(no + i + j);
+      if (!run[j]->valid) {
+        if (!miss && no + i + j == last_miss + 1) miss = 2; // sequential
+        else if (!miss) miss = 1;
+        bsubmit_read(run[j]);
+      }
+    }
+    uint32_t m = n;
+    if (miss == 2) {
+      // keep the readahead window going past the run like bgetcache does
+      for (uint32_t k = no + i + n; m < n + READAHEAD && k < bdev->nblk; ++k) {
+        if (blookup(k)) break;
+        run[m] = bget(k);
+        bsubmit_read(run[m++]);
+      }
+    }
+    if (miss) {
+      last_miss = no + i + m - 1;
+      blk_unplug(bdev);
+    }
+    for (uint32_t j = n; j < m; ++j) {
+      assert(run[j]->bio.err == 0);
+      run[j]->valid = 1;
+    }
+    for (uint32_t j = 0; j < n; ++j) {
+      if (!run[j]->valid) {
+        assert(run[j]->bio.err == 0);
+        run[j]->valid = 1;
+      }
+      memcpy(dst + (i + j) * BLK_SIZE, run[j]->data, BLK_SIZE);
+    }
+  }
+}
+
+void bwrite_run(const void *src, uint32_t no, uint32_t cnt) {
+  // whole blocks of file data need no read and are not logged, they go
+  // home before the group that maps them commits
+  for (uint32_t i = 0; i < cnt; ++i) {
+    buf_t *b = bget(no + i);
+    memcpy(b->data, src + i * BLK_SIZE, BLK_SIZE);
+    b->valid = 1;
+    bdirty(b);
+  }
+}
+
+void bcopy(uint32_t to, uint32_t toff, uint32_t from, uint32_t foff, uint32_t size) {
+  // cache to cache, a whole block is file data as in bwrite_run, a part is
+  // written like bwrite does
+  assert(size + toff <= BLK_SIZE && size + foff <= BLK_SIZE);
+  buf_t *src = bgetcache(from);
+  buf_t *dst = size == BLK_SIZE ? bget(to) : bgetcache(to);
+  memcpy(&dst->data[toff], &src->data[foff], size);
+  dst->valid = 1;
+  if (size == BLK_SIZE) bdirty(dst);
+  else blogged(dst);
+}
+
+// Direct transfers move whole blocks between the caller's pages and the
+// disk without taking buffers, so a bulk copy leaves cached metadata be.
+// A block the cache holds is read from its buffer. A write to one goes
+// into the buffer if the log or a mapping pins it, else the buffer is
+// dropped, so no cached copy goes stale.
+
+// callers are serialized by the fs lock, like the elevator's bounce
+static bio_t dbio[RUN_BATCH];
+
+static void *bframe(const void *va, int fill) {
+  // the frame behind the page at va, which the driver may DMA to; touched
+  // first so it is faulted in, and dirtied if the disk fills it
+  volatile char *p = (void *)va;
+  if (fill) *p = *p;
+  else (void)*p;
+  return vm_walk(vm_curr(), (size_t)va, 0);
+}
+
+void bread_direct(void *dst, uint32_t no, uint32_t cnt) {
+  // dst is page aligned
+  for (uint32_t i = 0; i < cnt; i += RUN_BATCH) {
+    uint32_t n = MIN(cnt - i, RUN_BATCH), m = 0;
+    for (uint32_t j = 0; j < n; ++j) {
+      void *to = dst + (i + j) * BLK_SIZE;
+      buf_t *b = blookup(no + i + j);
+      if (b && b->valid > 0) {
+        memcpy(to, b->data, BLK_SIZE);
+        continue;
+      }
+      dbio[m].no = no + i + j;
+      dbio[m].buf = bframe(to, 1);
+      dbio[m].write = 0;
+      blk_submit(bdev, &dbio[m++]);
+    }
+    if (m) blk_unplug(bdev);
+    for (uint32_t j = 0; j < m; ++j) assert(dbio[j].err == 0);
+  }
+}
+
+void bwrite_direct(const void *src, uint32_t no, uint32_t cnt) {
+  // file data like bwrite_run, src is page aligned
+  for (uint32_t i = 0; i < cnt; i += RUN_BATCH) {
+    uint32_t n = MIN(cnt - i, RUN_BATCH), m = 0;
+    for (uint32_t j = 0; j < n; ++j) {
+      const void *from = src + (i + j) * BLK_SIZE;
+      buf_t *b = blookup(no + i + j);
+      if (b && (b->logged || b->mapped || b->no >= BDELAY)) {
+        memcpy(b->data, from, BLK_SIZE);
+        b->valid = 1;
+        bdirty(b);
+        continue;
+      }
+      if (b) {
+        if (b->dirty) {
+          b->dirty = 0;
+          ndirty--;
+        }
+        bdrop(b->no);
+      }
+      dbio[m].no = no + i + j;
+      dbio[m].buf = bframe(from, 0);
+      dbio[m].write = 1;
+      blk_submit(bdev, &dbio[m++]);
+    }
+    if (m) blk_unplug(bdev);
+    for (uint32_t j = 0; j < m; ++j) assert(dbio[j].err == 0);
+  }
+}
+
+// File pages: a cached block of file data is tagged with the inode and
+// page index it holds, so the inode's page cache can point at the buffer
+// and reads, writes and user mappings share its frame. The tag goes when
+// the buffer is recycled or the block freed.
+
+// buffers user mappings may pin; with the delayed blocks and a full log
+// group pinned too, a run batch and its readahead still find buffers
+#define BUF_SLACK  (RUN_BATCH + READAHEAD)
+#define MAPPED_MAX (NBUF - BDELAY_NBUF - LOG_MAX - BUF_SLACK)
+
+struct buf *bpage(uint32_t no, void *owner, uint32_t idx) {
+  buf_t *b = bgetcache(no);
+  b->owner = owner;
+  b->idx = idx;
+  return b;
+}
+
+struct buf *btag(uint32_t no, void *owner, uint32_t idx) {
+  // only if block no is still in the cache
+  buf_t *b = blookup(no);
+  if (b == NULL || b->valid <= 0) return NULL;
+  b->owner = owner;
+  b->idx = idx;
+  return b;
+}
+
+void bforget(uint32_t no) {
+  // block no was freed, so it holds no file page. A frame that user
+  // mappings still pin is cut loose from the block: once the block goes
+  // to another file, the old mappers neither see its data nor write
+  // into it. A logged block keeps a buffer, as its group names it.
+  buf_t *b = blookup(no);
+  if (b == NULL) return;
+  b->owner = NULL;
+  if (b->mapped == 0) return;
+  bunhash(b);
+  if (b->dirty) {
+    b->dirty = 0;
+    ndirty--;
+  }
+  if (b->logged) {
+    buf_t *nb = bget(no);
+    memcpy(nb->data, b->data, BLK_SIZE);
+    nb->valid = 1;
+    nb->logged = 1;
+    for (uint32_t i = 0; i < blog.head.n; ++i) {
+      if (blog.bufs[i] == b) blog.bufs[i] = nb;
+    }
+    b->logged = 0;
+  }
+  b->no = 0;
+  b->valid = -1; // reused once the last mapping goes
+}
+
+int bpage_is(struct buf *b, void *owner, uint32_t idx) {
+  return b->owner == owner && b->idx == idx && b->valid > 0;
+}
+
+void bpage_read(struct buf *b, void *dst, uint32_t size, uint32_t off) {
+  assert(size + off <= BLK_SIZE);
+  memcpy(dst, &b->data[off], size);
+  lru_remove(b);
+  lru_push(b);
+}
+
+void bpage_write(struct buf *b, const void *src, uint32_t size, uint32_t off) {
+  // a whole block is file data as in bwrite_run, a part is written like
+  // bwrite does
+  assert(size + off <= BLK_SIZE);
+  memcpy(&b->data[off], src, size);
+  lru_remove(b);
+  lru_push(b);
+  if (size == BLK_SIZE) bdirty(b);
+  else blogged(b);
+}
+
+void *bpage_map(struct buf *b) {
+  // NULL for a cache-only block, its frame changes when it gets a home
+  static_assert(MAPPED_MAX >= NBUF / 8, "cache too small for its pins");
+  if (b->no >= BDELAY || (b->mapped == 0 && nmapped >= MAPPED_MAX)) return NULL;
+  if (b->mapped++ == 0) nmapped++;
+  return b->data;
+}
+
+int bunmap(void *frame, int dirty) {
+  // 0 if frame is not the data of a mapped buffer
+  for (int i = 0; i < NBUF; ++i) {
+    buf_t *b = &bufs[i];
+    if (b->data != frame || b->mapped == 0) continue;
+    if (dirty && b->valid > 0) bdirty(b); // not if cut loose by bforget
+    if (--b->mapped == 0) nmapped--;
+    return 1;
+  }
+  return 0;
 }
 
 void bzero(uint32_t no) {
-  bcache_t *bc = bgetcache(no);
-  memset(bc->buf, 0, BLK_SIZE);
-  copy_to_disk(bc->buf, BLK_SIZE, no * BLK_SIZE);
+  buf_t *b = bget(no);
+  memset(b->data, 0, BLK_SIZE);
+  b->valid = 1;
+  bdirty(b);
+}
+
+static void bsubmit_write(buf_t *b, uint32_t no) {
+  b->bio.no = no;
+  b->bio.buf = b->data;
+  b->bio.write = 1;
+  blk_submit(bdev, &b->bio);
+}
+
+static void bwriteback() {
+  // dirty blocks outside the log may go home at any time, this also
+  // sends whatever else was submitted
+  for (int i = 0; i < NBUF; ++i) {
+    if (bufs[i].dirty) bsubmit_write(&bufs[i], bufs[i].no);
+  }
+  blk_unplug(bdev);
+  for (int i = 0; i < NBUF; ++i) {
+    buf_t *b = &bufs[i];
+    if (b->dirty) {
+      assert(b->bio.err == 0);
+      b->dirty = 0;
+    }
+  }
+  ndirty = 0;
+}
+
+static uint32_t log_sum(uint8_t *blks[]) {
+  uint32_t h = 2166136261u; // FNV-1a over words
+  for (uint32_t i = 0; i < blog.head.n; ++i) {
+    uint32_t *w = (uint32_t *)blks[i];
+    for (int j = 0; j < BLK_SIZE / 4; ++j) h = (h ^ w[j]) * 16777619u;
+    h = (h ^ blog.head.no[i]) * 16777619u;
+  }
+  return h;
+}
+
+static buf_t *log_head() {
+  buf_t *b = bget(blog.start);
+  memcpy(b->data, &blog.head, sizeof(blog.head));
+  b->valid = 1;
+  bsubmit_write(b, blog.start);
+  return b;
+}
+
+static void log_commit() {
+  uint32_t n = blog.head.n;
+  uint8_t *blks[LOG_MAX];
+  bwriteback();
+  assert(blk_flush(bdev) == 0);
+  for (uint32_t i = 0; i < n; ++i) {
+    blks[i] = blog.bufs[i]->data;
+    blog.head.no[i] = blog.bufs[i]->no;
+    bsubmit_write(blog.bufs[i], blog.start + 1 + i);
+  }
+  blog.head.sum = log_sum(blks);
+  buf_t *h = log_head();
+  blk_unplug(bdev);
+  assert(h->bio.err == 0);
+  for (uint32_t i = 0; i < n; ++i) assert(blog.bufs[i]->bio.err == 0);
+  assert(blk_flush(bdev) == 0); // committed
+  for (uint32_t i = 0; i < n; ++i) bsubmit_write(blog.bufs[i], blog.head.no[i]);
+  blk_unplug(bdev);
+  for (uint32_t i = 0; i < n; ++i) {
+    assert(blog.bufs[i]->bio.err == 0);
+    blog.bufs[i]->logged = 0;
+  }
+  assert(blk_flush(bdev) == 0);
+  // home for good, so the group must not replay over the unlogged writes
+  // that may reach these blocks from now on
+  blog.head.n = 0;
+  h = log_head();
+  blk_unplug(bdev);
+  assert(h->bio.err == 0);
+  assert(blk_flush(bdev) == 0);
+}
+
+void log_mount(uint32_t start, uint32_t size) {
+  // replay the last group if its header and copies all made it to disk
+  memcpy(&blog.head, bgetcache(start)->data, sizeof(blog.head));
+  uint32_t n = blog.head.n;
+  blog.start = start;
+  blog.size = MIN(size, LOG_MAX + 1);
+  panic_on(n >= blog.size, "bad log header");
+  uint8_t *blks[LOG_MAX];
+  for (uint32_t i = 0; i < n; ++i) blks[i] = bgetcache(start + 1 + i)->data;
+  if (n && log_sum(blks) == blog.head.sum) {
+    for (uint32_t i = 0; i < n; ++i) {
+      buf_t *dst = bget(blog.head.no[i]);
+      memcpy(dst->data, bgetcache(start + 1 + i)->data, BLK_SIZE);
+      dst->valid = 1;
+      bdirty(dst);
+    }
+    blog.head.n = 0;
+    bsync();
+    log_head(); // cleared, so the next mount need not replay it again
+    blk_unplug(bdev);
+    assert(blk_flush(bdev) == 0);
+  }
+  blog.head.n = 0;
+}
+
+void log_begin() {
+  // a new op must fit in what is left of the log
+  if (blog.depth++ == 0 && blog.head.n + LOG_OP > blog.size - 1) bsync();
+}
+
+void log_end(int commit) {
+  // commit asks for the group to be on disk once the outermost op ends
+  assert(blog.depth > 0);
+  blog.commit |= commit;
+  if (--blog.depth == 0 && blog.commit) {
+    blog.commit = 0;
+    bsync();
+  }
+}
+
+void bmove(uint32_t from, uint32_t to) {
+  // a cache-only block got its disk block, the data goes there as a write
+  buf_t *src = blookup(from);
+  assert(from >= BDELAY && src && src->valid);
+  buf_t *dst = bget(to);
+  memcpy(dst->data, src->data, BLK_SIZE);
+  dst->valid = 1;
+  bdirty(dst);
+  bdrop(from);
+}
+
+void bdrop(uint32_t no) {
+  buf_t *b = blookup(no);
+  if (b == NULL) return;
+  assert(!b->dirty && !b->logged);
+  bunhash(b);
+  b->no = 0; // not pinned any more
+  b->valid = -1;
+  b->owner = NULL;
+  lru_remove(b); // reused first
+  b->next = &lru;
+  b->prev = lru.prev;
+  lru.prev->next = b;
+  lru.prev = b;
+}
+
+void bsync() {
+  if (blog.head.n) {
+    log_commit();
+    return;
+  }
+  if (ndirty == 0) return;
+  bwriteback();
+  assert(blk_flush(bdev) == 0);
 }
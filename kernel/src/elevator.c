@@ -0,0 +1,94 @@
+#include "klib.h"
+#include "blk.h"
+#include "timer.h"
+
+// Batch sorting, not a running scheduler: the cache submits the blocks of
+// one operation and unplugs them itself under the fs lock, so a batch only
+// ever holds one caller's requests and transfers go to the driver one at a
+// time, each waited for. In a batch, reads and writes sit in two lists
+// sorted by block no and are served in one ascending sweep (C-SCAN) from
+// the current head, reads first unless a write has waited past its
+// deadline. Consecutive blocks in the same direction become one transfer.
+
+#define MAX_MERGE    32  // blocks per transfer
+#define WRITE_EXPIRE 50  // ticks
+
+// a transfer is done before the next starts, so one bounce buffer is enough
+static uint8_t bounce[MAX_MERGE * BLK_SIZE] PG_ALIGN;
+
+void blk_submit(blkdev_t *dev, bio_t *bio) {
+  if (bio->no >= dev->nblk) {
+    bio->err = -1;
+    return;
+  }
+  bio_t **q = bio->write ? &dev->wq : &dev->rq;
+  while (*q && (*q)->no <= bio->no) q = &(*q)->next;
+  bio->next = *q;
+  *q = bio;
+  bio->err = 0;
+  bio->expire = get_tick() + WRITE_EXPIRE;
+  if (++dev->queued > dev->stat.maxbatch) {
+    dev->stat.maxbatch = dev->queued;
+  }
+}
+
+static int write_expired(blkdev_t *dev) {
+  for (bio_t *b = dev->wq; b; b = b->next) {
+    if ((int)(get_tick() - b->expire) >= 0) return 1;
+  }
+  return 0;
+}
+
+static void dispatch(blkdev_t *dev, bio_t **q) {
+  // first request at or after the head, wrap around to the lowest
+  bio_t **pp = q;
+  while (*pp && (*pp)->no < dev->head) pp = &(*pp)->next;
+  if (*pp == NULL) pp = q;
+
+  bio_t *run[MAX_MERGE];
+  int n = 0;
+  do {
+    run[n++] = *pp;
+    *pp = (*pp)->next;
+  } while (n < MAX_MERGE && *pp && (*pp)->no == run[n - 1]->no + 1);
+
+  int write = run[0]->write, err;
+  uint32_t no = run[0]->no;
+  if (n == 1) {
+    err = write ? dev->write(dev, run[0]->buf, no, 1) : dev->read(dev, run[0]->buf, no, 1);
+  } else if (write) {
+    for (int i = 0; i < n; ++i) {
+      memcpy(bounce + i * BLK_SIZE, run[i]->buf, BLK_SIZE);
+    }
+    err = dev->write(dev, bounce, no, n);
+  } else {
+    err = dev->read(dev, bounce, no, n);
+    for (int i = 0; i < n; ++i) {
+      memcpy(run[i]->buf, bounce + i * BLK_SIZE, BLK_SIZE);
+    }
+  }
+  for (int i = 0; i < n; ++i) {
+    run[i]->err = err;
+  }
+
+  dev->head = no + n;
+  dev->queued -= n;
+  dev->stat.merges += n - 1;
+  if (write) {
+    dev->stat.wios++;
+    dev->stat.wblks += n;
+  } else {
+    dev->stat.rios++;
+    dev->stat.rblks += n;
+  }
+}
+
+void blk_unplug(blkdev_t *dev) {
+  while (dev->rq || dev->wq) {
+    if (dev->wq && (dev->rq == NULL || write_expired(dev))) {
+      dispatch(dev, &dev->wq);
+    } else {
+      dispatch(dev, &dev->rq);
+    }
+  }
+}
@@ -2,6 +2,7 @@
 #include "file.h"
 
 #define TOTAL_FILE 128
+#define DEV_CHUNK  512 // sendfile to a dev goes through the kernel stack
 
 file_t files[TOTAL_FILE];
 
@@ -50,6 +51,7 @@ file_t *fopen(const char *path, int mode) {
     fp->type = type; // file_t don't and needn't distingush between file and dir
     fp->inode = ip;
     fp->offset = 0;
+    fp->direct = type == TYPE_FILE && (mode & O_DIRECT);
   } else if (type == TYPE_DEV) {
     fp->type = TYPE_DEV;
     fp->dev_op = dev_get(idevid(ip));
@@ -78,7 +80,8 @@ int fread(file_t *file, void *buf, uint32_t size) {//DONE
     size = MIN(size, readable_size);
     if(size == 0) return 0;
     */
-    len = iread(file->inode, file->offset, buf, size);
+    if (file->direct) len = iread_direct(file->inode, file->offset, buf, size);
+    else len = iread(file->inode, file->offset, buf, size);
     assert(len <= size);
     if(len >= 0) file->offset += (uint32_t)len;
   }
@@ -102,10 +105,11 @@ int fwrite(file_t *file, const void *buf, uint32_t size) {//DONE
     size = MIN(size, writeable_size);
     if(size == 0) return 0;
     */
-    len = iwrite(file->inode, file->offset, buf, size);
+    if (file->direct) len = iwrite_direct(file->inode, file->offset, buf, size);
+    else len = iwrite(file->inode, file->offset, buf, size);
+    if(len < 0) return -1;
     assert(len <= size);
-    if(len == -1) return -1;
-    if(len >= 0) file->offset += (uint32_t)len;
+    file->offset += (uint32_t)len;
   }
   if(file->type == TYPE_DEV)
   {
@@ -115,8 +119,97 @@ int fwrite(file_t *file, const void *buf, uint32_t size) {//DONE
   return len;
 }
 
+int fpread(file_t *file, void *buf, uint32_t size, uint32_t off) {
+  // at off, the file's offset stays where it is, a dev has none
+  if (!file->readable) return -1;
+  if (file->type != TYPE_FILE && file->type != TYPE_DIR) return -1;
+  if (file->direct) return iread_direct(file->inode, off, buf, size);
+  return iread(file->inode, off, buf, size);
+}
+
+int fpwrite(file_t *file, const void *buf, uint32_t size, uint32_t off) {
+  if (!file->writable) return -1;
+  if (file->type != TYPE_FILE) return -1;
+  if (file->direct) return iwrite_direct(file->inode, off, buf, size);
+  return iwrite(file->inode, off, buf, size);
+}
+
+int freadv(file_t *file, const struct iovec *iov, int cnt) {
+  // fills the pieces in turn, a short read ends it
+  if (!file->readable) return -1;
+  int len = 0, rd;
+  if (file->type == TYPE_FILE || file->type == TYPE_DIR) {
+    len = ireadv(file->inode, file->offset, iov, cnt);
+    if (len > 0) file->offset += len;
+  } else if (file->type == TYPE_DEV) {
+    for (int i = 0; i < cnt; ++i) {
+      rd = file->dev_op->read(iov[i].iov_base, iov[i].iov_len);
+      if (rd < 0) return len ? len : -1;
+      len += rd;
+      if (rd < iov[i].iov_len) break;
+    }
+  } else return -1;
+  return len;
+}
+
+int fwritev(file_t *file, const struct iovec *iov, int cnt) {
+  if (!file->writable) return -1;
+  int len = 0, wr;
+  if (file->type == TYPE_FILE || file->type == TYPE_DIR) {
+    len = iwritev(file->inode, file->offset, iov, cnt);
+    if (len > 0) file->offset += len;
+  } else if (file->type == TYPE_DEV) {
+    for (int i = 0; i < cnt; ++i) {
+      wr = file->dev_op->write(iov[i].iov_base, iov[i].iov_len);
+      if (wr < 0) return len ? len : -1;
+      len += wr;
+      if (wr < iov[i].iov_len) break;
+    }
+  } else return -1;
+  return len;
+}
+
+int fsendfile(file_t *out, file_t *in, uint32_t *off, uint32_t len) {
+  // from in's offset, or from *off if off is not NULL and then in's offset
+  // stays; the data never leaves the kernel
+  if (!in->readable || !out->writable || in->type != TYPE_FILE) return -1;
+  uint32_t pos = off ? *off : in->offset;
+  int ret = 0, rd;
+  if (out->type == TYPE_FILE) {
+    ret = icopy(out->inode, out->offset, in->inode, pos, len);
+    if (ret < 0) return -1;
+    out->offset += ret;
+  } else if (out->type == TYPE_DEV) {
+    char buf[DEV_CHUNK];
+    while (ret < len) {
+      rd = iread(in->inode, pos + ret, buf, MIN(len - ret, sizeof buf));
+      if (rd <= 0) break;
+      rd = out->dev_op->write(buf, rd);
+      if (rd <= 0) break;
+      ret += rd;
+    }
+  } else return -1;
+  if (off) *off = pos + ret;
+  else in->offset = pos + ret;
+  return ret;
+}
+
+int fcopy_range(file_t *in, uint32_t *off_in, file_t *out, uint32_t *off_out, uint32_t len) {
+  // file to file, a NULL offset means the file's own one
+  if (!in->readable || !out->writable) return -1;
+  if (in->type != TYPE_FILE || out->type != TYPE_FILE) return -1;
+  uint32_t *pin = off_in ? off_in : &in->offset;
+  uint32_t *pout = off_out ? off_out : &out->offset;
+  int ret = icopy(out->inode, *pout, in->inode, *pin, len);
+  if (ret < 0) return -1;
+  *pin += ret;
+  *pout += ret;
+  return ret;
+}
+
 uint32_t fseek(file_t *file, uint32_t off, int whence) {
-  // Lab3-1, change file's offset, do not let it cross file's size
+  // Lab3-1, change file's offset, a file may seek past its end and a
+  // write there leaves a hole, a dir may not
   if (file->type == TYPE_FILE || file->type == TYPE_DIR) {
     //TODO();
     switch (whence)
@@ -126,13 +219,38 @@ uint32_t fseek(file_t *file, uint32_t off, int whence) {
     case SEEK_SET: file->offset = off; break;
     default:       break;
     }
-    assert(file->offset >= 0);
-    assert(file->offset <= isize(file->inode));
+    if (file->type == TYPE_DIR && file->offset > isize(file->inode)) {
+      file->offset = isize(file->inode);
+    }
     return file->offset;
   }
   return -1;
 }
 
+int fsync(file_t *file) {
+  // a dev writes through
+  if (file->type == TYPE_FILE || file->type == TYPE_DIR) isync(file->inode);
+  return 0;
+}
+
+int ftruncate(file_t *file, uint32_t len) {
+  // the offset stays, even past the new end
+  if (!file->writable || file->type != TYPE_FILE) return -1;
+  return itruncate(file->inode, len);
+}
+
+int fallocate(file_t *file, uint32_t off, uint32_t len) {
+  if (!file->writable || file->type != TYPE_FILE || len == 0) return -1;
+  return iallocate(file->inode, off, len);
+}
+
+int fgetdents(file_t *file, struct dirstat *buf, uint32_t size) {
+  // fills whole entries only, returns the bytes filled, 0 at the end
+  if (file->type != TYPE_DIR || !file->readable) return -1;
+  int n = idirread(file->inode, &file->offset, buf, size / sizeof(struct dirstat));
+  return n < 0 ? -1 : n * sizeof(struct dirstat);
+}
+
 file_t *fdup(file_t *file) {
   // Lab3-1, inc file's ref, then return itself
   // TODO();
@@ -2,118 +2,16 @@
 #include "fs.h"
 #include "disk.h"
 #include "proc.h"
-
-#ifdef EASY_FS
-
-#define MAX_FILE  (SECTSIZE / sizeof(dinode_t))
-#define MAX_DEV   16
-#define MAX_INODE (MAX_FILE + MAX_DEV)
-
-// On disk inode
-typedef struct dinode {
-  uint32_t start_sect;
-  uint32_t length;
-  char name[MAX_NAME + 1];
-} dinode_t;
-
-// On OS inode, dinode with special info
-struct inode {
-  int valid;
-  int type;
-  int dev; // dev_id if type==TYPE_DEV
-  dinode_t dinode;
-};
-
-static inode_t inodes[MAX_INODE];
-
-void init_fs() {
-  dinode_t buf[MAX_FILE];
-  read_disk(buf, 256);
-  for (int i = 0; i < MAX_FILE; ++i) {
-    inodes[i].valid = 1;
-    inodes[i].type = TYPE_FILE;
-    inodes[i].dinode = buf[i];
-  }
-}
-
-inode_t *iopen(const char *path, int type) {
-  for (int i = 0; i < MAX_INODE; ++i) {
-    if (!inodes[i].valid) continue;
-    if (strcmp(path, inodes[i].dinode.name) == 0) {
-      return &inodes[i];
-    }
-  }
-  return NULL;
-}
-
-int iread(inode_t *inode, uint32_t off, void *buf, uint32_t len) {
-  assert(inode);
-  char *cbuf = buf;
-  char dbuf[SECTSIZE];
-  uint32_t curr = -1;
-  uint32_t total_len = inode->dinode.length;
-  uint32_t st_sect = inode->dinode.start_sect;
-  int i;
-  for (i = 0; i < len && off < total_len; ++i, ++off) {
-    if (curr != off / SECTSIZE) {
-      read_disk(dbuf, st_sect + off / SECTSIZE);
-      curr = off / SECTSIZE;
-    }
-    *cbuf++ = dbuf[off % SECTSIZE];
-  }
-  return i;
-}
-
-void iadddev(const char *name, int id) {
-  assert(id < MAX_DEV);
-  inode_t *inode = &inodes[MAX_FILE + id];
-  inode->valid = 1;
-  inode->type = TYPE_DEV;
-  inode->dev = id;
-  strcpy(inode->dinode.name, name);
-}
-
-uint32_t isize(inode_t *inode) {
-  return inode->dinode.length;
-}
-
-int itype(inode_t *inode) {
-  return inode->type;
-}
-
-uint32_t ino(inode_t *inode) {
-  return inode - inodes;
-}
-
-int idevid(inode_t *inode) {
-  return inode->type == TYPE_DEV ? inode->dev : -1;
-}
-
-int iwrite(inode_t *inode, uint32_t off, const void *buf, uint32_t len) {
-  panic("write doesn't support");
-}
-
-void itrunc(inode_t *inode) {
-  panic("trunc doesn't support");
-}
-
-inode_t *idup(inode_t *inode) {
-  return inode;
-}
-
-void iclose(inode_t *inode) { /* do nothing */ }
-
-int iremove(const char *path) {
-  panic("remove doesn't support");
-}
-
-#else
-
-#define DISK_SIZE (128 * 1024 * 1024)
-#define BLK_NUM   (DISK_SIZE / BLK_SIZE)
+#include "blk.h"
+#include "vme.h"
+#include "timer.h"
+#include "vfs.h"
 
 #define NDIRECT   12
 #define NINDIRECT (BLK_SIZE / sizeof(uint32_t))
+#define NEXTENT   6
+#define INLINE_MAX (NEXTENT * 3 * sizeof(uint32_t)) // bytes a file keeps in its inode
+#define MAX_RUN   32 // blocks allocated at once for a write
 
 #define IPERBLK   (BLK_SIZE / sizeof(dinode_t)) // inode num per blk
 
@@ -123,28 +21,140 @@ typedef struct super_block {
   uint32_t istart; // start block no of inode blocks
   uint32_t inum;   // total inode num
   uint32_t root;   // inode no of root dir
+  uint32_t nblk;   // blocks covered by the bitmap
+  uint32_t magic;
+  uint32_t nfree;  // free blocks
+  uint32_t ifree;  // free inodes
+  uint32_t logstart; // block no of the redo log header
+  uint32_t nlog;     // blocks of the log, 0 if there is none
 } sb_t;
 
+#define FS_MAGIC 0x4f534c63
+
 // On disk inode
 typedef struct dinode {
   uint32_t type;   // file type
-  uint32_t device; // if it is a dev, its dev_id
+  union {
+    uint32_t device; // if it is a dev, its dev_id
+    uint32_t dindex; // if it is a dir, block no of its hash index or 0
+  };
   uint32_t size;   // file size
-  uint32_t addrs[NDIRECT + 1]; // data block addresses, 12 direct and 1 indirect
+  uint32_t flags;
+  union {
+    uint32_t addrs[NDIRECT + 2]; // 12 direct, 1 indirect and 1 double indirect
+    struct extent {
+      uint32_t lblk;  // first block in the file
+      uint32_t start; // first block on disk
+      uint32_t len;   // 0 if the slot is unused
+    } ext[NEXTENT];   // sorted by lblk
+    uint8_t idata[INLINE_MAX];
+  };
+  uint32_t mtime;  // last data change, seconds since the epoch
+  uint32_t ctime;  // last inode change
+  uint32_t reserved[8]; // pads the inode to 128 bytes
 } dinode_t;
 
-struct inode {
+#define DI_EXTENT 0x1 // blocks are mapped by ext[], else by addrs[]
+#define DI_INLINE 0x2 // no blocks, the bytes are in idata[]
+
+// An inode of the disk in memory, the node diskfs hands the VFS
+typedef struct dnode {
   int no;
   int ref;
   int del;
+  int dirty; // dinode changed since the last iupdate
+  int pending; // written since it was last closed, so the close commits
+  uint32_t dlblk, dcnt, dblk; // delayed window, file blocks dlblk.. in cache blocks dblk..
+  struct pcnode *pages; // page cache, pheight levels deep
+  int pheight;
   dinode_t dinode;
-};
+  struct dnode *hnext;       // hash chain
+  struct dnode *prev, *next; // LRU of unreferenced inodes, or free list
+} dnode_t;
 
 #define SUPER_BLOCK 32
 static sb_t sb;
 
-void init_fs() {
+// A proc may sleep on disk I/O in the middle of an fs operation, so the
+// whole fs is guarded by the VFS's sleep lock
+static void fs_lock() {
+  vfs_lock();
+}
+
+static void fs_unlock() {
+  vfs_unlock();
+}
+
+// Both bitmaps live in memory, the block one mirrors its disk block and
+// the inode one is rebuilt from the inode table at mount
+static uint32_t bmap[BLK_SIZE / 4];
+static uint32_t imap[BLK_SIZE / 4];
+static uint32_t bhint, ihint; // word the next search starts from
+
+static void sbupdate() {
+  // only the counters change after mkfs, nblk may be clamped in memory
+  bwrite(&sb.nfree, 2 * sizeof(uint32_t), SUPER_BLOCK, offsetof(sb_t, nfree));
+}
+
+static uint32_t bitmap_count(uint32_t *map, uint32_t nbit) {
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < nbit; ++i) {
+    if (map[i / 32] & (1 << (i % 32))) used++;
+  }
+  return nbit - used;
+}
+
+static void diread(dinode_t *di, uint32_t no);
+
+static void fs_mount(blkdev_t *dev) {
+  bmount(dev);
   bread(&sb, sizeof(sb), SUPER_BLOCK, 0);
+  panic_on(sb.magic != FS_MAGIC, "bad super block");
+  if (sb.nlog) {
+    log_mount(sb.logstart, sb.nlog);
+    bread(&sb, sizeof(sb), SUPER_BLOCK, 0); // the log may have replayed it
+  }
+  assert(sb.nblk <= BLK_SIZE * 8 && sb.inum <= BLK_SIZE * 8);
+  bread(bmap, BLK_SIZE, sb.bitmap, 0);
+  if (sb.nblk > dev->nblk) {
+    // the image may be made for a larger disk, fine if the tail is unused
+    for (uint32_t i = dev->nblk; i < sb.nblk; ++i) {
+      panic_on(bmap[i / 32] & (1 << (i % 32)), "fs does not fit the device");
+    }
+    sb.nblk = dev->nblk / 32 * 32;
+  }
+  memset(imap, 0, sizeof(imap));
+  imap[0] = 1; // inode 0 marks a free dirent
+  for (uint32_t i = 1; i < sb.inum; ++i) {
+    dinode_t di;
+    diread(&di, i);
+    if (di.type != TYPE_NONE) imap[i / 32] |= 1 << (i % 32);
+  }
+  for (uint32_t i = sb.inum; i % 32; ++i) {
+    imap[i / 32] |= 1 << (i % 32); // tail of the last word is never free
+  }
+  // recount rather than trust a summary a crash may have left stale
+  sb.nfree = bitmap_count(bmap, sb.nblk);
+  sb.ifree = bitmap_count(imap, sb.inum);
+  sbupdate();
+  printf("fs: mounted %s, %d/%d blocks, %d/%d inodes free\n",
+         dev->name, sb.nfree, sb.nblk, sb.ifree, sb.inum);
+}
+
+// next-fit search for a clear bit among the first nbit, sets it
+static int bitmap_alloc(uint32_t *map, uint32_t nbit, uint32_t *hint) {
+  uint32_t nword = (nbit + 31) / 32;
+  for (uint32_t i = 0; i < nword; ++i) {
+    uint32_t w = (*hint + i) % nword;
+    if (map[w] != 0xffffffff) {
+      uint32_t no = w * 32 + bsf(~map[w]);
+      if (no >= nbit) continue;
+      map[w] |= 1 << (no % 32);
+      *hint = w;
+      return no;
+    }
+  }
+  return -1;
 }
 
 #define I2BLKNO(no)  (sb.istart + no / IPERBLK)
@@ -158,121 +168,155 @@ static void diwrite(const dinode_t *di, uint32_t no) {
   bwrite(di, sizeof(dinode_t), I2BLKNO(no), I2BLKOFF(no));
 }
 
-static uint32_t dialloc(int type) {//Done!
+static uint32_t dialloc(int type) {
+  int no = bitmap_alloc(imap, sb.inum, &ihint);
+  assert(no > 0); // out of inodes
   dinode_t dinode;
-  uint32_t x = 1;
-  while(x < sb.inum)
-  {
-    diread(&dinode, x);
-    if(dinode.type == TYPE_NONE)
-    {
-      dinode.type = type;
-      diwrite(&dinode, x);
-      return x;
-    }
-    x++;
-  }
-  assert(0);
+  diread(&dinode, no);
+  dinode.type = type;
+  dinode.flags = DI_EXTENT | DI_INLINE;
+  dinode.mtime = dinode.ctime = get_time();
+  diwrite(&dinode, no);
+  sb.ifree--;
+  sbupdate();
+  return no;
 }
 
 static void difree(uint32_t no) {
   dinode_t dinode;
   memset(&dinode, 0, sizeof dinode);
   diwrite(&dinode, no);
+  imap[no / 32] &= ~(1 << (no % 32));
+  sb.ifree++;
+  sbupdate();
 }
 
+#define BTEST(no) (bmap[(no) / 32] & (1 << ((no) % 32)))
 
-static uint32_t balloc() {
-  uint32_t byte;
-  for (int i = 0; i < BLK_NUM / 32; ++i) {
-    bread(&byte, 4, sb.bitmap, i * 4);
-    if (byte != 0xffffffff) {
-    uint32_t x = 0;
-    while(x <= 31)
-    {
-      uint32_t flag = (1 << x) & byte;
-      uint32_t pos = 32 * i + x;
-      if(flag == 0)
-      {
-        byte = byte | (1 << x);
-        bzero(pos);
-        bwrite(&byte, 4, sb.bitmap, i * 4);
-        return pos;
-      } 
-      x++;
-    }
-    }
+// allocate up to want free blocks in a row, starting at goal if it is
+// free, else wherever the next-fit search lands; got tells how many
+static uint32_t balloc_run(uint32_t goal, uint32_t want, uint32_t *got) {
+  uint32_t start = goal;
+  if (goal == 0 || goal >= sb.nblk || BTEST(goal)) {
+    int no = bitmap_alloc(bmap, sb.nblk, &bhint);
+    assert(no > 0); // disk full
+    bmap[no / 32] &= ~(1 << (no % 32)); // set again below
+    start = no;
   }
-  assert(0);
+  uint32_t n = 0;
+  while (n < want && start + n < sb.nblk && !BTEST(start + n)) {
+    uint32_t no = start + n++;
+    bmap[no / 32] |= 1 << (no % 32);
+    bzero(no);
+  }
+  for (uint32_t w = start / 32; w <= (start + n - 1) / 32; ++w) {
+    bwrite(&bmap[w], 4, sb.bitmap, w * 4);
+  }
+  sb.nfree -= n;
+  sbupdate();
+  *got = n;
+  return start;
+}
+
+static uint32_t balloc() {
+  uint32_t got;
+  return balloc_run(0, 1, &got);
 }
 
 static void bfree(uint32_t blkno) {
   assert(blkno >= 64); // cannot free first 64 block
-  uint32_t data = 0;
-  bread(&data, sizeof(uint32_t), sb.bitmap, blkno >> 5);
-  uint32_t m = (1 << (blkno % 32));
-  uint32_t mask = ~m;
-  data &= mask;
-  bwrite(&data, sizeof(uint32_t), sb.bitmap, blkno >> 5);
+  assert(bmap[blkno / 32] & (1 << (blkno % 32)));
+  bmap[blkno / 32] &= ~(1 << (blkno % 32));
+  bwrite(&bmap[blkno / 32], 4, sb.bitmap, blkno / 32 * 4);
+  bforget(blkno); // no file page any more, nor a mapping of it
+  sb.nfree++;
+  sbupdate();
 }
 
-#define INODE_NUM 128
-//The Kernel Inode Table!
-static inode_t inodes[INODE_NUM];
+// In-memory inodes are hashed by inode no. An inode whose last ref is
+// closed stays cached on an LRU list and is recycled only when more than
+// ICACHE_IDLE are idle, referenced inodes are never capped.
+#define IHASH       127
+#define ICACHE_IDLE 256
 
-static inode_t *iget(uint32_t no) {
-  uint32_t x = 1;
-  while (x < INODE_NUM)
-  {
-    inode_t *node_ptr = &inodes[x];
-    if(node_ptr->no == no)
-    {
-      node_ptr->ref++;
-      return node_ptr;
+static dnode_t *ihash[IHASH];
+static dnode_t ilru = {.prev = &ilru, .next = &ilru}; // most recent first
+static dnode_t *ifree_list;
+static int nidle;
+
+static void ilru_remove(dnode_t *ip) {
+  ip->prev->next = ip->next;
+  ip->next->prev = ip->prev;
+  nidle--;
+}
+
+static void ilru_push(dnode_t *ip) {
+  ip->next = ilru.next;
+  ip->prev = &ilru;
+  ilru.next->prev = ip;
+  ilru.next = ip;
+  nidle++;
+}
+
+static void iunhash(dnode_t *ip) {
+  dnode_t **pp = &ihash[ip->no % IHASH];
+  while (*pp != ip) pp = &(*pp)->hnext;
+  *pp = ip->hnext;
+}
+
+static void pdrop(dnode_t *inode);
+
+static dnode_t *inode_alloc() {
+  if (nidle >= ICACHE_IDLE) {
+    dnode_t *ip = ilru.prev;
+    ilru_remove(ip);
+    iunhash(ip);
+    pdrop(ip);
+    return ip;
+  }
+  if (ifree_list == NULL) {
+    // grow by a page worth of inodes, kfree never gives memory back anyway
+    dnode_t *page = kalloc();
+    for (int i = 0; i < PGSIZE / sizeof(dnode_t); ++i) {
+      page[i].next = ifree_list;
+      ifree_list = &page[i];
     }
-    x++;
   }
-  uint32_t y = 1;
-  while (y < INODE_NUM)
-  {
-    inode_t *node_ptr = &inodes[y];
-    if(node_ptr->ref == 0)
-    {
-      node_ptr->ref++;
-      node_ptr->no = no;
-      node_ptr->del = 0;
-      diread(&(inodes[y].dinode), no);
-      return node_ptr;
+  dnode_t *ip = ifree_list;
+  ifree_list = ip->next;
+  return ip;
+}
+
+static dnode_t *iget(uint32_t no) {
+  dnode_t *ip;
+  for (ip = ihash[no % IHASH]; ip; ip = ip->hnext) {
+    if (ip->no == no) {
+      if (ip->ref++ == 0) ilru_remove(ip);
+      return ip;
     }
-    y++;
   }
-  assert(0);
+  ip = inode_alloc();
+  ip->no = no;
+  ip->ref = 1;
+  ip->del = ip->dirty = ip->pending = 0;
+  ip->dcnt = 0;
+  ip->pages = NULL;
+  ip->pheight = 0;
+  diread(&ip->dinode, no);
+  ip->hnext = ihash[no % IHASH];
+  ihash[no % IHASH] = ip;
+  return ip;
 }
 
-static void iupdate(inode_t *inode) {
+static void iupdate(dnode_t *inode) {
   diwrite(&inode->dinode, inode->no);
+  inode->dirty = 0;
 }
 
-static const char* skipelem(const char *path, char *name) {
-  const char *s;
-  int len;
-  while (*path == '/') path++;
-  if (*path == 0) return 0;
-  s = path;
-  while(*path != '/' && *path != 0) path++;
-  len = path - s;
-  if (len >= MAX_NAME) {
-    memcpy(name, s, MAX_NAME);
-    name[MAX_NAME] = 0;
-  } else {
-    memcpy(name, s, len);
-    name[len] = 0;
-  }
-  while (*path == '/') path++;
-  return path;
-}
+static int iread_locked(dnode_t *inode, uint32_t off, void *buf, uint32_t len);
+static int iwrite_locked(dnode_t *inode, uint32_t off, const void *buf, uint32_t len);
 
-static void idirinit(inode_t *inode, inode_t *parent) {
+static void idirinit(dnode_t *inode, dnode_t *parent) {
   // Lab3-2: init the dir inode, i.e. create . and .. dirent
   assert(inode->dinode.type == TYPE_DIR);
   assert(parent->dinode.type == TYPE_DIR); // both should be dir
@@ -281,132 +325,537 @@ static void idirinit(inode_t *inode, inode_t *parent) {
   // set .
   dirent.inode = inode->no;
   strcpy(dirent.name, ".");
-  iwrite(inode, 0, &dirent, sizeof dirent);
+  iwrite_locked(inode, 0, &dirent, sizeof dirent);
   // set ..
   dirent.inode = parent->no;
   strcpy(dirent.name, "..");
-  iwrite(inode, sizeof dirent, &dirent, sizeof dirent);
+  iwrite_locked(inode, sizeof dirent, &dirent, sizeof dirent);
+}
+
+
+// Dentry cache: (dir ino, name) -> ino, where ino 0 records that the name
+// is absent. Entries are updated in place on create and remove.
+#define NDENTRY 512
+#define DHASH   257
+
+typedef struct dentry {
+  uint32_t parent;
+  uint32_t ino;
+  uint32_t off; // offset of the dirent in the parent
+  char name[MAX_NAME + 1];
+  struct dentry *hnext;
+  struct dentry *prev, *next; // LRU, most recent first
+} dentry_t;
+
+static dentry_t dentries[NDENTRY];
+static dentry_t *dhash[DHASH];
+static dentry_t dlru = {.prev = &dlru, .next = &dlru};
+
+static uint32_t dhashfn(uint32_t parent, const char *name) {
+  uint32_t h = parent * 31;
+  while (*name) h = h * 131 + *name++;
+  return h % DHASH;
+}
+
+static void dlru_move(dentry_t *d) {
+  if (d->next) { // not yet on the list when fresh
+    d->prev->next = d->next;
+    d->next->prev = d->prev;
+  }
+  d->next = dlru.next;
+  d->prev = &dlru;
+  dlru.next->prev = d;
+  dlru.next = d;
+}
+
+static dentry_t *dlookup(uint32_t parent, const char *name) {
+  for (dentry_t *d = dhash[dhashfn(parent, name)]; d; d = d->hnext) {
+    if (d->parent == parent && strcmp(d->name, name) == 0) {
+      dlru_move(d);
+      return d;
+    }
+  }
+  return NULL;
+}
+
+static void dunhash(dentry_t *d) {
+  dentry_t **pp = &dhash[dhashfn(d->parent, d->name)];
+  while (*pp && *pp != d) pp = &(*pp)->hnext;
+  if (*pp) *pp = d->hnext;
+}
+
+static void dinsert(uint32_t parent, const char *name, uint32_t ino, uint32_t off) {
+  dentry_t *d = dlookup(parent, name);
+  if (d == NULL) {
+    static int nused;
+    if (nused < NDENTRY) {
+      d = &dentries[nused++];
+    } else {
+      d = dlru.prev;
+      dunhash(d);
+    }
+    d->parent = parent;
+    strcpy(d->name, name);
+    uint32_t h = dhashfn(parent, name);
+    d->hnext = dhash[h];
+    dhash[h] = d;
+    dlru_move(d);
+  }
+  d->ino = ino;
+  d->off = off;
+}
+
+// forget the entries of a dir whose inode is freed, the no may be reused
+static void dpurge(uint32_t parent) {
+  for (int i = 0; i < NDENTRY; ++i) {
+    dentry_t *d = &dentries[i];
+    if (d->next && d->parent == parent) {
+      dunhash(d);
+      d->parent = 0; // inode 0 is never a dir
+    }
+  }
+}
+
+// A dir with DIR_INDEX_MIN entries gets a hash index. Its top block
+// holds the live dirent count, then IDX_NBUCKET bucket block nos. A
+// bucket block holds a pair count, the next block of the bucket (0 at
+// the end), then (name hash, dirent offset) pairs. Indexed dirs only
+// append, and a bucket whose blocks are full goes on in a fresh one.
+#define DIR_INDEX_MIN 64
+#define IDX_NBUCKET   64
+#define IDX_NPAIR     (BLK_SIZE / 8 - 1)
+#define IDX_BATCH     32 // pairs read per bread, the kernel stack is small
+
+static uint32_t namehash(const char *name) {
+  uint32_t h = 2166136261u; // FNV-1a
+  while (*name) h = (h ^ (uint8_t)*name++) * 16777619u;
+  return h;
+}
+
+static uint32_t idx_bucket(dnode_t *dir, uint32_t h, int alloc) {
+  uint32_t top = dir->dinode.dindex, blk, i = 1 + h % IDX_NBUCKET;
+  bread(&blk, 4, top, i * 4);
+  if (blk == 0 && alloc) {
+    blk = balloc();
+    bwrite(&blk, 4, top, i * 4);
+  }
+  return blk;
+}
+
+static void idx_count(dnode_t *dir, int delta) {
+  uint32_t cnt;
+  bread(&cnt, 4, dir->dinode.dindex, 0);
+  cnt += delta;
+  bwrite(&cnt, 4, dir->dinode.dindex, 0);
+}
+
+static void idx_drop(dnode_t *dir) {
+  uint32_t top = dir->dinode.dindex, blk, next;
+  for (int i = 1; i <= IDX_NBUCKET; ++i) {
+    bread(&blk, 4, top, i * 4);
+    for (; blk; blk = next) {
+      bread(&next, 4, blk, 4);
+      bfree(blk);
+    }
+  }
+  bfree(top);
+  dir->dinode.dindex = 0;
+  iupdate(dir);
+}
+
+static void idx_add(dnode_t *dir, const char *name, uint32_t off) {
+  uint32_t h = namehash(name), blk = idx_bucket(dir, h, 1), hdr[2];
+  // the first block of the bucket with room, a fresh one at its end if none
+  for (bread(hdr, 8, blk, 0); hdr[0] == IDX_NPAIR; bread(hdr, 8, blk, 0)) {
+    if (hdr[1] == 0) {
+      hdr[1] = balloc();
+      bwrite(&hdr[1], 4, blk, 4);
+    }
+    blk = hdr[1];
+  }
+  uint32_t pair[2] = {h, off};
+  bwrite(pair, sizeof pair, blk, 8 + hdr[0] * 8);
+  hdr[0]++;
+  bwrite(&hdr[0], 4, blk, 0);
+  idx_count(dir, 1);
+}
+
+static void idx_del(dnode_t *dir, const char *name, uint32_t off) {
+  uint32_t blk = idx_bucket(dir, namehash(name), 0), hdr[2], pair[2];
+  assert(blk);
+  for (; blk; blk = hdr[1]) {
+    bread(hdr, 8, blk, 0);
+    for (uint32_t i = 0; i < hdr[0]; ++i) {
+      bread(pair, sizeof pair, blk, 8 + i * 8);
+      if (pair[1] == off) {
+        // the last pair of the block fills the hole
+        hdr[0]--;
+        bread(pair, sizeof pair, blk, 8 + hdr[0] * 8);
+        bwrite(pair, sizeof pair, blk, 8 + i * 8);
+        bwrite(&hdr[0], 4, blk, 0);
+        idx_count(dir, -1);
+        return;
+      }
+    }
+  }
+  assert(0);
+}
+
+// offset of name's dirent, or the dir size if it is absent
+static uint32_t idx_lookup(dnode_t *dir, const char *name, dirent_t *dirent) {
+  uint32_t h = namehash(name), blk = idx_bucket(dir, h, 0), hdr[2];
+  uint32_t pairs[IDX_BATCH][2];
+  for (; blk; blk = hdr[1]) {
+    bread(hdr, 8, blk, 0);
+    for (uint32_t i = 0; i < hdr[0]; i += IDX_BATCH) {
+      uint32_t cnt = MIN(hdr[0] - i, IDX_BATCH);
+      bread(pairs, cnt * 8, blk, 8 + i * 8);
+      for (uint32_t j = 0; j < cnt; ++j) {
+        if (pairs[j][0] != h) continue;
+        iread_locked(dir, pairs[j][1], dirent, sizeof(dirent_t));
+        if (strcmp(dirent->name, name) == 0) return pairs[j][1];
+      }
+    }
+  }
+  return dir->dinode.size;
 }
 
+static void idx_build(dnode_t *dir) {
+  dir->dinode.dindex = balloc();
+  iupdate(dir);
+  dirent_t dirent;
+  for (uint32_t i = 0; i < dir->dinode.size; i += sizeof(dirent_t)) {
+    iread_locked(dir, i, &dirent, sizeof(dirent_t));
+    if (dirent.inode) idx_add(dir, dirent.name, i);
+  }
+}
 
-static inode_t *ilookup(inode_t *parent, const char *name, uint32_t *off, int type) {
+static dnode_t *ilookup(dnode_t *parent, const char *name, uint32_t *off, int type) {
   assert(parent->dinode.type == TYPE_DIR); // parent must be a dir
+  dentry_t *d = dlookup(parent->no, name);
+  if (d && d->ino) {
+    if (off != NULL) *off = d->off;
+    return iget(d->ino);
+  }
+  if (d && type == TYPE_NONE) return NULL;
   dirent_t dirent;
   uint32_t size = parent->dinode.size, empty = size;
-  inode_t *f = NULL;
+  dnode_t *f = NULL;
   uint32_t i = 0;
-  while(i < size)
-  {
-    iread(parent, i, &dirent, sizeof(dirent_t));
-    if(dirent.inode == 0)
-    {
-      if(empty == size) empty = i;
+  if (parent->dinode.dindex) {
+    i = idx_lookup(parent, name, &dirent);
+  } else {
+    while (i < size) {
+      iread_locked(parent, i, &dirent, sizeof(dirent_t));
+      if (dirent.inode == 0) {
+        if (empty == size) empty = i;
+      } else if (strcmp(dirent.name, name) == 0) {
+        break;
+      }
       i = i + sizeof(dirent_t);
-      continue;
-    }
-    if(strcmp(dirent.name, name) == 0)
-    {
-      f = iget(dirent.inode);
-      if(off != NULL) *off = i;
-      return f;
     }
-    i = i + sizeof(dirent_t);
   }
-  if (type == TYPE_NONE) return NULL;
+  if (i < size) {
+    f = iget(dirent.inode);
+    if(off != NULL) *off = i;
+    dinsert(parent->no, name, dirent.inode, i);
+    return f;
+  }
+  if (type == TYPE_NONE) {
+    dinsert(parent->no, name, 0, 0);
+    return NULL;
+  }
   uint32_t num = dialloc(type);
   f = iget(num);
+  f->pending = 1;
   dirent.inode = num;
   strcpy(dirent.name, name);
   if(type == TYPE_DIR) idirinit(f, parent);
-  iwrite(parent, empty, &dirent, sizeof(dirent));
+  iwrite_locked(parent, empty, &dirent, sizeof(dirent));
+  if (parent->dinode.dindex) {
+    idx_add(parent, name, empty);
+  } else if (parent->dinode.size >= DIR_INDEX_MIN * sizeof(dirent_t)) {
+    idx_build(parent);
+  }
   if(off != NULL) *off = empty;
+  dinsert(parent->no, name, num, empty);
   return f;
 }
 
-static inode_t *iopen_parent(const char *path, char *name) {
-  inode_t *ip, *next;
-  if (path[0] == '/') {
-    ip = iget(sb.root);
-  } else {
-    ip = idup(proc_curr()->cwd);
+// entry idx of indirect block ind, set to blk (or a fresh block if blk is
+// BALLOC) when it is empty and blk is not 0
+#define BALLOC ((uint32_t)-1)
+
+static uint32_t ind_get(uint32_t ind, uint32_t idx, uint32_t blk) {
+  uint32_t no;
+  bread(&no, 4, ind, idx * 4);
+  if (no == 0 && blk) {
+    no = blk == BALLOC ? balloc() : blk;
+    bwrite(&no, 4, ind, idx * 4);
   }
-  assert(ip);
-  while ((path = skipelem(path, name))) {
-    if (ip->dinode.type != TYPE_DIR) {
-      iclose(ip);
-      return NULL;
-    }
-    if (*path == 0) {
-      return ip;
+  return no;
+}
+
+static uint32_t iwalk_blk(dnode_t *inode, uint32_t no, uint32_t blk) {
+  uint32_t *addrs = inode->dinode.addrs;
+  if (no < NDIRECT) {
+    if (addrs[no] == 0 && blk) {
+      addrs[no] = blk == BALLOC ? balloc() : blk;
+      inode->dirty = 1;
     }
-    next = ilookup(ip, name, NULL, 0);
-    if (next == NULL) {
-      iclose(ip);
-      return NULL;
+    return addrs[no];
+  }
+  no -= NDIRECT;
+  int level = no < NINDIRECT ? 1 : 2;
+  if (level == 2) {
+    no -= NINDIRECT;
+    assert(no < NINDIRECT * NINDIRECT); // file too big
+  }
+  uint32_t *root = &addrs[NDIRECT + level - 1];
+  if (*root == 0) {
+    if (blk == 0) return 0;
+    *root = balloc();
+    inode->dirty = 1;
+  }
+  uint32_t ind = *root;
+  if (level == 2 && (ind = ind_get(ind, no / NINDIRECT, blk ? BALLOC : 0)) == 0) return 0;
+  return ind_get(ind, no % NINDIRECT, blk);
+}
+
+// out of extent slots: move the mapping to addrs[] for good
+static void iext_convert(dnode_t *inode) {
+  struct extent ext[NEXTENT];
+  memcpy(ext, inode->dinode.ext, sizeof(ext));
+  memset(inode->dinode.ext, 0, sizeof(ext));
+  inode->dinode.flags &= ~DI_EXTENT;
+  for (int i = 0; i < NEXTENT; ++i) {
+    for (uint32_t j = 0; j < ext[i].len; ++j) {
+      iwalk_blk(inode, ext[i].lblk + j, ext[i].start + j);
     }
-    iclose(ip);
-    ip = next;
   }
-  iclose(ip);
-  return NULL;
+  inode->dirty = 1;
 }
 
-inode_t *iopen(const char *path, int type) {
-  char name[MAX_NAME + 1];
-  memset(name, 0, sizeof(name));
-  if (skipelem(path, name) == NULL) {
-    return path[0] == '/' ? iget(sb.root) : NULL;
-  }
-  inode_t *ptr = iopen_parent(path, name);
-  if(ptr == NULL) return NULL;  
-  inode_t *f = ilookup(ptr, name, NULL, type);
-  iclose(ptr);
-  return f;
+static uint32_t iwalk_ext(dnode_t *inode, uint32_t no, uint32_t want) {
+  struct extent *ext = inode->dinode.ext;
+  int n = 0;
+  for (; n < NEXTENT && ext[n].len && ext[n].lblk <= no; ++n) {
+    if (no < ext[n].lblk + ext[n].len) return ext[n].start + no - ext[n].lblk;
+  }
+  // ext[n] is the first extent past no, if any
+  if (want == 0) return 0;
+  if (n < NEXTENT && ext[n].len) want = MIN(want, ext[n].lblk - no);
+  struct extent *prev = n ? &ext[n - 1] : NULL;
+  uint32_t goal = prev ? prev->start + no - prev->lblk : 0, got;
+  int append = prev && no == prev->lblk + prev->len;
+  if (ext[NEXTENT - 1].len && !(append && goal < sb.nblk && !BTEST(goal))) {
+    iext_convert(inode);
+    return iwalk_blk(inode, no, BALLOC);
+  }
+  uint32_t start = balloc_run(goal, want, &got);
+  if (append && start == goal) {
+    prev->len += got;
+  } else {
+    memmove(&ext[n + 1], &ext[n], (NEXTENT - 1 - n) * sizeof(struct extent));
+    ext[n].lblk = no;
+    ext[n].start = start;
+    ext[n].len = got;
+  }
+  inode->dirty = 1;
+  return start;
 }
 
-static uint32_t iwalk(inode_t *inode, uint32_t no) {
-  uint32_t blkno = 0, cur;
-  if (no < NDIRECT) {
-    cur = inode->dinode.addrs[no];
-    if(cur == 0)
-    {
-      cur = balloc();
-      inode->dinode.addrs[no] = cur;
-      iupdate(inode);
-    }
-    return inode->dinode.addrs[no];
+// disk block of file block no, allocating a run of up to want blocks
+// when it is not mapped and want is not 0
+static uint32_t iwalk_disk(dnode_t *inode, uint32_t no, uint32_t want) {
+  if (inode->dinode.flags & DI_EXTENT) return iwalk_ext(inode, no, want);
+  return iwalk_blk(inode, no, want ? BALLOC : 0);
+}
+
+// Delayed allocation: a file's writes to unmapped blocks fill a window of
+// cache-only blocks, which gets disk blocks in one run when it is full,
+// when the file is closed, or when another file needs the window. Files
+// appended to in turn still get long extents that way.
+#define DELAY_MAX 32 // blocks in a window, at most MAX_RUN
+#define NDELAY    3  // windows at once, their blocks are pinned in the cache
+
+static dnode_t *delayed[NDELAY];
+static int dvictim;
+
+// close the window, giving its blocks disk blocks or dropping them
+static void idelay_end(dnode_t *inode, int keep) {
+  uint32_t cnt = inode->dcnt;
+  inode->dcnt = 0;
+  for (uint32_t i = 0; i < cnt; ++i) {
+    // in order, so one run covers the rest whenever the bitmap allows
+    if (keep) bmove(inode->dblk + i, iwalk_disk(inode, inode->dlblk + i, cnt - i));
+    else bdrop(inode->dblk + i);
   }
-  no -= NDIRECT;
-  if (no < NINDIRECT) {
-    if(inode->dinode.addrs[NDIRECT] == 0)
-    {
-      inode->dinode.addrs[NDIRECT] = balloc();
-      iupdate(inode);
+  for (int i = 0; i < NDELAY; ++i) {
+    if (delayed[i] == inode) delayed[i] = NULL;
+  }
+  if (inode->dirty) iupdate(inode);
+}
+
+// cache-only block for file block no, opening or growing the window
+static uint32_t idelay(dnode_t *inode, uint32_t no) {
+  static_assert(NDELAY * DELAY_MAX <= BDELAY_NBUF, "windows pin too many buffers");
+  if (inode->dcnt && (no != inode->dlblk + inode->dcnt || inode->dcnt == DELAY_MAX)) {
+    idelay_end(inode, 1);
+  }
+  if (inode->dcnt == 0) {
+    int i = 0;
+    while (i < NDELAY && delayed[i]) i++;
+    if (i == NDELAY) {
+      i = dvictim++ % NDELAY;
+      idelay_end(delayed[i], 1);
     }
-    uint32_t ind_blk = inode->dinode.addrs[NDIRECT];
-    bread(&blkno, 4, ind_blk, no << 2);
-    if(blkno == 0)
-    {
-      blkno = balloc();
-      bwrite(&blkno, 4, ind_blk, no << 2);
+    delayed[i] = inode;
+    inode->dlblk = no;
+    inode->dblk = BDELAY + i * DELAY_MAX;
+  }
+  uint32_t blk = inode->dblk + inode->dcnt++;
+  bzero(blk);
+  return blk;
+}
+
+// as iwalk_disk, but a file's unmapped blocks are delayed rather than
+// allocated, and blocks in the window map to their cache-only blocks
+static uint32_t iwalk(dnode_t *inode, uint32_t no, uint32_t want) {
+  if (no - inode->dlblk < inode->dcnt) return inode->dblk + no - inode->dlblk;
+  uint32_t blk = iwalk_disk(inode, no, 0);
+  if (blk || want == 0) return blk;
+  if (inode->dinode.type == TYPE_FILE) return idelay(inode, no);
+  return iwalk_disk(inode, no, want);
+}
+
+// map up to max blocks from no on that are contiguous on disk, or all
+// holes when it returns 0; cnt tells how many
+static uint32_t iwalk_run(dnode_t *inode, uint32_t no, uint32_t max, int alloc, uint32_t *cnt) {
+  uint32_t start = iwalk(inode, no, alloc ? MIN(max, MAX_RUN) : 0), n = 1;
+  while (n < max) {
+    // growing a full window would move the blocks of the run so far
+    if (start >= BDELAY && no + n == inode->dlblk + DELAY_MAX) break;
+    uint32_t next = iwalk(inode, no + n, alloc ? MIN(max - n, MAX_RUN) : 0);
+    if (start ? next != start + n : next != 0) break;
+    n++;
+  }
+  *cnt = n;
+  return start;
+}
+
+// Page cache: a radix tree per inode from file page index to the cached
+// buffer holding that page, so reads, writes and mmap faults reach the data
+// without mapping the block again and all share its one frame. A page is
+// a block. The buffers stay on the block cache's LRU and are reclaimed
+// like any other; a slot whose buffer went on to other data is a miss.
+#define PC_BITS 6
+#define PC_FAN  (1 << PC_BITS)
+
+typedef struct pcnode {
+  void *slot[PC_FAN]; // lower nodes, or buffers at the bottom level
+  struct pcnode *next; // free list
+} pcnode_t;
+
+static pcnode_t *pcfree;
+
+static pcnode_t *pcnode_alloc() {
+  if (pcfree == NULL) {
+    pcnode_t *page = kalloc();
+    for (int i = 0; i < PGSIZE / sizeof(pcnode_t); ++i) {
+      page[i].next = pcfree;
+      pcfree = &page[i];
     }
-    return blkno;
   }
-  assert(0); // file too big, not need to handle this case
+  pcnode_t *n = pcfree;
+  pcfree = n->next;
+  memset(n, 0, sizeof(*n));
+  return n;
 }
 
-int iread(inode_t *inode, uint32_t off, void *buf, uint32_t len) {
+static void pcnode_free(pcnode_t *n, int height) {
+  if (n == NULL) return;
+  for (int i = 0; height > 1 && i < PC_FAN; ++i) pcnode_free(n->slot[i], height - 1);
+  n->next = pcfree;
+  pcfree = n;
+}
+
+static void pdrop(dnode_t *inode) {
+  pcnode_free(inode->pages, inode->pheight);
+  inode->pages = NULL;
+  inode->pheight = 0;
+}
+
+static struct buf *pfind(dnode_t *inode, uint32_t idx) {
+  if (((uint64_t)idx >> (PC_BITS * inode->pheight)) != 0) return NULL;
+  pcnode_t *n = inode->pages;
+  for (int h = inode->pheight; n && h > 1; --h) {
+    n = n->slot[(idx >> (PC_BITS * (h - 1))) % PC_FAN];
+  }
+  if (n == NULL) return NULL;
+  struct buf *b = n->slot[idx % PC_FAN];
+  return b && bpage_is(b, inode, idx) ? b : NULL;
+}
+
+static void pinsert(dnode_t *inode, uint32_t idx, struct buf *b) {
+  if (inode->pages == NULL) {
+    inode->pages = pcnode_alloc();
+    inode->pheight = 1;
+  }
+  while (((uint64_t)idx >> (PC_BITS * inode->pheight)) != 0) {
+    // one level up, the old root becomes the first slot
+    pcnode_t *root = pcnode_alloc();
+    root->slot[0] = inode->pages;
+    inode->pages = root;
+    inode->pheight++;
+  }
+  pcnode_t *n = inode->pages;
+  for (int h = inode->pheight; h > 1; --h) {
+    void **s = &n->slot[(idx >> (PC_BITS * (h - 1))) % PC_FAN];
+    if (*s == NULL) *s = pcnode_alloc();
+    n = *s;
+  }
+  n->slot[idx % PC_FAN] = b;
+}
+
+// page idx is in cache block no
+static void ptag(dnode_t *inode, uint32_t idx, uint32_t no) {
+  struct buf *b = btag(no, inode, idx);
+  if (b) pinsert(inode, idx, b);
+}
+
+static int iread_locked(dnode_t *inode, uint32_t off, void *buf, uint32_t len) {
   uint32_t file_sz = inode->dinode.size;
+  if(off >= file_sz) return 0;
   if(off + len > file_sz) len = file_sz - off;
-  uint32_t ret = len, num, no, offset, rd = 0;
+  if (inode->dinode.flags & DI_INLINE) {
+    memcpy(buf, &inode->dinode.idata[off], len);
+    return len;
+  }
+  uint32_t ret = len, num, no, offset, rd = 0, cnt;
+  struct buf *b;
   for(; len != 0;)
   {
     offset = off % BLK_SIZE;
     num = off / BLK_SIZE;
-    no = iwalk(inode, num);
-    if(len < BLK_SIZE - offset) rd = len;
-    else rd = BLK_SIZE - offset;
-    bread(buf, rd, no, offset);
+    if ((b = pfind(inode, num))) {
+      rd = MIN(len, BLK_SIZE - offset);
+      bpage_read(b, buf, rd, offset);
+    } else if (offset == 0 && len >= BLK_SIZE) {
+      // whole blocks, one run at a time
+      no = iwalk_run(inode, num, len / BLK_SIZE, 0, &cnt);
+      rd = cnt * BLK_SIZE;
+      if (no) bread_run(buf, no, cnt);
+      else memset(buf, 0, rd);
+      for (uint32_t i = 0; no && i < cnt; ++i) ptag(inode, num + i, no + i);
+    } else {
+      no = iwalk(inode, num, 0);
+      if(len < BLK_SIZE - offset) rd = len;
+      else rd = BLK_SIZE - offset;
+      if (no) bread(buf, rd, no, offset);
+      else memset(buf, 0, rd); // a hole
+      if (no) ptag(inode, num, no);
+    }
     buf = buf + rd;
     off = off + rd;
     len = len - rd;
@@ -414,17 +863,63 @@ int iread(inode_t *inode, uint32_t off, void *buf, uint32_t len) {
   return ret;
 }
 
-int iwrite(inode_t *inode, uint32_t off, const void *buf, uint32_t len) {
-  if(off > inode->dinode.size) return -1;
-  uint32_t num, no, offset, wr = 0, sz = len, end = off + len;
+// the data changed, the inode goes out with the caller's iupdate
+static void itouch(dnode_t *inode) {
+  uint32_t now = get_time();
+  if (inode->dinode.mtime == now) return;
+  inode->dinode.mtime = inode->dinode.ctime = now;
+  inode->dirty = 1;
+}
+
+// the file outgrew its inode, its bytes move to a block
+static void iunline(dnode_t *inode) {
+  uint8_t data[INLINE_MAX];
+  uint32_t size = inode->dinode.size;
+  memcpy(data, inode->dinode.idata, size);
+  memset(inode->dinode.idata, 0, INLINE_MAX);
+  inode->dinode.flags &= ~DI_INLINE;
+  inode->dirty = 1;
+  if (size) iwrite_locked(inode, 0, data, size);
+}
+
+static int iwrite_locked(dnode_t *inode, uint32_t off, const void *buf, uint32_t len) {
+  // writing past the end leaves the skipped blocks unmapped
+  uint32_t num, no, offset, wr = 0, sz = len, end = off + len, cnt;
+  if (end < off) return -1; // past the largest size a dinode holds
+  itouch(inode);
+  if (inode->dinode.flags & DI_INLINE) {
+    if (end > INLINE_MAX) {
+      iunline(inode);
+    } else {
+      // bytes past the old end are still zero
+      memcpy(&inode->dinode.idata[off], buf, len);
+      if (end > inode->dinode.size) inode->dinode.size = end;
+      iupdate(inode);
+      return sz;
+    }
+  }
+  struct buf *b;
   for(;len > 0;)
   {
     offset = off % BLK_SIZE;
     num = off / BLK_SIZE;
-    no = iwalk(inode, num);
-    if(len < BLK_SIZE - offset) wr = len;
-    else wr = BLK_SIZE - offset;
-    bwrite(buf, wr, no, offset);
+    if ((b = pfind(inode, num))) {
+      wr = MIN(len, BLK_SIZE - offset);
+      bpage_write(b, buf, wr, offset);
+    } else if (offset == 0 && len >= BLK_SIZE) {
+      // at most MAX_RUN at a time so the fresh zeroed blocks are overwritten
+      // before the dirty limit pushes them out
+      no = iwalk_run(inode, num, MIN(len / BLK_SIZE, MAX_RUN), 1, &cnt);
+      wr = cnt * BLK_SIZE;
+      bwrite_run(buf, no, cnt);
+      for (uint32_t i = 0; i < cnt; ++i) ptag(inode, num + i, no + i);
+    } else {
+      no = iwalk(inode, num, MIN((off + len - 1) / BLK_SIZE - num + 1, MAX_RUN));
+      if(len < BLK_SIZE - offset) wr = len;
+      else wr = BLK_SIZE - offset;
+      bwrite(buf, wr, no, offset);
+      ptag(inode, num, no);
+    }
     buf = buf + wr;
     off = off + wr;
     len = len - wr;
@@ -432,80 +927,312 @@ int iwrite(inode_t *inode, uint32_t off, const void *buf, uint32_t len) {
   if(end > inode->dinode.size)
   {
     inode->dinode.size = end;
-    iupdate(inode);
+    inode->dirty = 1;
   }
+  if (inode->dirty) iupdate(inode); // once per call however many blocks it took
   return sz;
 }
-void itrunc(inode_t *inode) {
-  inode->dinode.size = 0;
-  uint32_t blk_no = 0;
-  for (int i = 0 ; i < NDIRECT ; i++)
-    {
-      blk_no = inode->dinode.addrs[i];
-      if(blk_no == 0) continue;
-      else bfree(blk_no);
+
+// O_DIRECT: whole blocks go between buf and the disk without the cache,
+// see bread_direct; anything not block and page aligned goes through it
+static int idirect_ok(uint32_t off, const void *buf, uint32_t len) {
+  return len && off % BLK_SIZE == 0 && len % BLK_SIZE == 0 && (size_t)buf % PGSIZE == 0;
+}
+
+static int iread_direct_locked(dnode_t *inode, uint32_t off, void *buf, uint32_t len) {
+  if (!idirect_ok(off, buf, len) || (inode->dinode.flags & DI_INLINE)) {
+    return iread_locked(inode, off, buf, len);
+  }
+  uint32_t file_sz = inode->dinode.size, tail, no, cnt, rd;
+  if (off >= file_sz) return 0;
+  if (off + len > file_sz) len = file_sz - off;
+  tail = len % BLK_SIZE; // the last block of the file, partly
+  for (rd = 0; rd < len - tail; rd += cnt * BLK_SIZE) {
+    // a delayed block is in the cache, so bread_direct finds it there
+    no = iwalk_run(inode, (off + rd) / BLK_SIZE, (len - tail - rd) / BLK_SIZE, 0, &cnt);
+    if (no) bread_direct(buf + rd, no, cnt);
+    else memset(buf + rd, 0, cnt * BLK_SIZE);
+  }
+  if (tail) iread_locked(inode, off + rd, buf + rd, tail);
+  return len;
+}
+
+static int iwrite_direct_locked(dnode_t *inode, uint32_t off, const void *buf, uint32_t len) {
+  if (!idirect_ok(off, buf, len)) return iwrite_locked(inode, off, buf, len);
+  if (off + len < off) return -1;
+  uint32_t num = off / BLK_SIZE, nblk = len / BLK_SIZE, no, n;
+  itouch(inode);
+  if (inode->dinode.flags & DI_INLINE) iunline(inode);
+  // the window's blocks get their disk blocks, the new ones are taken
+  // right away as their data does not wait in the cache
+  if (inode->dcnt) idelay_end(inode, 1);
+  for (uint32_t i = 0; i < nblk; i += n) {
+    no = iwalk_disk(inode, num + i, MIN(nblk - i, MAX_RUN));
+    for (n = 1; i + n < nblk && iwalk_disk(inode, num + i + n, MIN(nblk - i - n, MAX_RUN)) == no + n; ++n);
+    bwrite_direct(buf + i * BLK_SIZE, no, n);
+  }
+  if (off + len > inode->dinode.size) {
+    inode->dinode.size = off + len;
+    inode->dirty = 1;
+  }
+  if (inode->dirty) iupdate(inode);
+  return len;
+}
+#define IND_BATCH 64 // entries read at once, the kernel stack is small
+
+// data blocks ind maps
+static uint32_t ind_count(uint32_t ind, int level) {
+  uint32_t ents[IND_BATCH], n = 0;
+  for (uint32_t i = 0; i < NINDIRECT; i += IND_BATCH) {
+    bread(ents, sizeof ents, ind, i * 4);
+    for (uint32_t j = 0; j < IND_BATCH; ++j) {
+      if (ents[j]) n += level == 1 ? 1 : ind_count(ents[j], level - 1);
     }
-  if(inode->dinode.addrs[NDIRECT] == 0)
-  {
-    iupdate(inode);
-    return;
   }
-  uint32_t tmp = inode->dinode.addrs[NDIRECT];
-  for (int i = 0 ; i < NINDIRECT; i++)
-    {
-      bread(&blk_no, 4, tmp, i << 2);
-      if(blk_no == 0) continue;
-      else bfree(blk_no);
+  return n;
+}
+
+static void ind_free(uint32_t ind, int level) {
+  if (ind == 0) return;
+  for (uint32_t i = 0; i < NINDIRECT; ++i) {
+    uint32_t no = ind_get(ind, i, 0);
+    if (no == 0) continue;
+    if (level == 1) bfree(no);
+    else ind_free(no, level - 1);
+  }
+  bfree(ind);
+}
+
+static void itrunc_locked(dnode_t *inode) {
+  dinode_t *di = &inode->dinode;
+  idelay_end(inode, 0);
+  pdrop(inode);
+  if (di->type == TYPE_DIR && di->dindex) idx_drop(inode);
+  if (di->flags & DI_INLINE) {
+    // nothing to free
+  } else if (di->flags & DI_EXTENT) {
+    for (int i = 0; i < NEXTENT; ++i) {
+      for (uint32_t j = 0; j < di->ext[i].len; ++j) {
+        bfree(di->ext[i].start + j);
+      }
     }
+  } else {
+    for (int i = 0; i < NDIRECT; ++i) {
+      if (di->addrs[i]) bfree(di->addrs[i]);
+    }
+    ind_free(di->addrs[NDIRECT], 1);
+    ind_free(di->addrs[NDIRECT + 1], 2);
+  }
+  memset(di->ext, 0, sizeof(di->ext));
+  di->size = 0;
+  di->flags = DI_EXTENT | DI_INLINE; // small again
+  itouch(inode);
   iupdate(inode);
-  return;
 }
 
-inode_t *idup(inode_t *inode) {
-  assert(inode);
-  inode->ref ++;
-  return inode;
+// free what ind maps from entry from on, where a level 2 entry spans
+// NINDIRECT file blocks; 1 if that left ind empty, and freed too
+static int ind_trunc(uint32_t ind, int level, uint32_t from) {
+  uint32_t span = level == 1 ? 1 : NINDIRECT, i = from / span, no, zero = 0;
+  if (from == 0) {
+    ind_free(ind, level);
+    return 1;
+  }
+  if (from % span) {
+    // the entry the new end falls in keeps its head, if it has one
+    if ((no = ind_get(ind, i, 0)) && ind_trunc(no, level - 1, from % span)) {
+      bwrite(&zero, 4, ind, i * 4);
+    }
+    i++;
+  }
+  for (; i < NINDIRECT; ++i) {
+    if ((no = ind_get(ind, i, 0)) == 0) continue;
+    if (level == 1) bfree(no);
+    else ind_free(no, level - 1);
+    bwrite(&zero, 4, ind, i * 4);
+  }
+  // a sparse head may map nothing
+  for (i = 0; i < (from + span - 1) / span; ++i) {
+    if (ind_get(ind, i, 0)) return 0;
+  }
+  bfree(ind);
+  return 1;
 }
 
-void iclose(inode_t *inode) {
-  assert(inode);
-  if (inode->ref == 1 && inode->del) {
-    itrunc(inode);
-    difree(inode->no);
+// free the file's blocks from block keep on
+static void ifree_from(dnode_t *inode, uint32_t keep) {
+  dinode_t *di = &inode->dinode;
+  if (di->flags & DI_EXTENT) {
+    // sorted, so the extents emptied are the last ones
+    for (int i = 0; i < NEXTENT; ++i) {
+      struct extent *e = &di->ext[i];
+      uint32_t from = MAX(e->lblk, keep);
+      if (e->len == 0 || from >= e->lblk + e->len) continue;
+      for (uint32_t b = from; b < e->lblk + e->len; ++b) bfree(e->start + b - e->lblk);
+      e->len = from - e->lblk;
+      if (e->len == 0) e->lblk = e->start = 0;
+    }
+  } else {
+    uint32_t *addrs = di->addrs, from;
+    for (uint32_t i = keep; i < NDIRECT; ++i) {
+      if (addrs[i]) bfree(addrs[i]);
+      addrs[i] = 0;
+    }
+    from = keep > NDIRECT ? keep - NDIRECT : 0;
+    if (addrs[NDIRECT] && from < NINDIRECT && ind_trunc(addrs[NDIRECT], 1, from)) {
+      addrs[NDIRECT] = 0;
+    }
+    from = keep > NDIRECT + NINDIRECT ? keep - NDIRECT - NINDIRECT : 0;
+    if (addrs[NDIRECT + 1] && ind_trunc(addrs[NDIRECT + 1], 2, from)) {
+      addrs[NDIRECT + 1] = 0;
+    }
   }
-  inode->ref -= 1;
+  inode->dirty = 1;
 }
 
-uint32_t isize(inode_t *inode) {
-  return inode->dinode.size;
+// to len, a shrink frees the blocks past it and a growth leaves a hole
+static void itruncate_locked(dnode_t *inode, uint32_t len) {
+  dinode_t *di = &inode->dinode;
+  uint32_t keep = (len + BLK_SIZE - 1) / BLK_SIZE, no;
+  if (len == 0) {
+    itrunc_locked(inode);
+    return;
+  }
+  if ((di->flags & DI_INLINE) && len > INLINE_MAX) {
+    iunline(inode);
+  } else if (len < di->size && (di->flags & DI_INLINE)) {
+    memset(&di->idata[len], 0, di->size - len);
+  } else if (len < di->size) {
+    // the window is dropped if none of it stays
+    if (inode->dcnt) idelay_end(inode, inode->dlblk < keep);
+    ifree_from(inode, keep);
+    if (len % BLK_SIZE && (no = iwalk_disk(inode, len / BLK_SIZE, 0))) {
+      // the bytes past the end read as zero if the file grows again
+      char zero[SECTSIZE];
+      memset(zero, 0, sizeof zero);
+      for (uint32_t off = len % BLK_SIZE, n; off < BLK_SIZE; off += n) {
+        n = MIN(BLK_SIZE - off, SECTSIZE);
+        bwrite(zero, n, no, off);
+      }
+    }
+  }
+  di->size = len;
+  inode->dirty = 1;
+  itouch(inode);
+  iupdate(inode);
 }
 
-int itype(inode_t *inode) {
-  return inode->dinode.type;
+// aim the next-fit search at the first bitmap word from which want blocks
+// are free, 0 if there is none
+static int bhint_run(uint32_t want) {
+  uint32_t start = 0;
+  for (uint32_t no = 0; no < sb.nblk; ++no) {
+    if (BTEST(no)) {
+      start = (no / 32 + 1) * 32;
+    } else if (no >= start && no + 1 - start >= want) {
+      bhint = start / 32;
+      return 1;
+    }
+  }
+  return 0;
 }
 
-uint32_t ino(inode_t *inode) {
-  return inode->no;
+// disk blocks for [off, off + len) up front, in as long a run as the
+// bitmap has, so a file that then grows piece by piece stays in one
+// extent; -1 if there are not enough free blocks
+static int iallocate_locked(dnode_t *inode, uint32_t off, uint32_t len) {
+  dinode_t *di = &inode->dinode;
+  uint32_t end = off + len, first = off / BLK_SIZE, last = (end - 1) / BLK_SIZE, need = 0;
+  if (end < off) return -1;
+  if (!(di->flags & DI_INLINE) || end > INLINE_MAX) {
+    for (uint32_t b = first; b <= last; ++b) {
+      if ((di->flags & DI_INLINE) || iwalk_disk(inode, b, 0) == 0) need++;
+    }
+    // and the indirect blocks that may map them, and the delayed window
+    if (need + need / NINDIRECT + DELAY_MAX + 4 > sb.nfree) return -1;
+    itouch(inode);
+    if (di->flags & DI_INLINE) iunline(inode);
+    if (inode->dcnt) idelay_end(inode, 1);
+    for (uint32_t want = need; want > 1 && !bhint_run(want); want /= 2);
+    for (uint32_t b = first; b <= last; ++b) iwalk_disk(inode, b, MIN(last - b + 1, MAX_RUN));
+  }
+  if (end > di->size) {
+    di->size = end;
+    inode->dirty = 1;
+  }
+  if (inode->dirty) iupdate(inode);
+  return 0;
 }
 
-int idevid(inode_t *inode) {
-  return itype(inode) == TYPE_DEV ? inode->dinode.device : -1;
+static void iclose_locked(dnode_t *inode) {
+  assert(inode && inode->ref > 0);
+  if (inode->dcnt && !inode->del) idelay_end(inode, 1); // on disk once closed
+  if (--inode->ref > 0) return;
+  if (inode->del) {
+    if (inode->dinode.type == TYPE_DIR) dpurge(inode->no);
+    itrunc_locked(inode);
+    difree(inode->no);
+    iunhash(inode);
+    inode->next = ifree_list;
+    ifree_list = inode;
+  } else {
+    ilru_push(inode);
+  }
 }
 
-void iadddev(const char *name, int id) {
-  inode_t *ip = iopen(name, TYPE_DEV);
-  assert(ip);
-  ip->dinode.device = id;
-  iupdate(ip);
-  iclose(ip);
+// what stat reports: blocks, and the extents too when ext[] holds them,
+// an addrs[] file only counts its entries and leaves extents 0
+static void iblocks(dnode_t *inode, uint32_t *blocks, uint32_t *extents) {
+  dinode_t *di = &inode->dinode;
+  uint32_t nblk = (di->size + BLK_SIZE - 1) / BLK_SIZE;
+  *blocks = *extents = 0;
+  if (di->flags & DI_INLINE) return;
+  if (di->flags & DI_EXTENT) {
+    for (int i = 0; i < NEXTENT; ++i) {
+      struct extent *e = &di->ext[i], *p = e - 1;
+      if (e->len == 0 || e->lblk >= nblk) continue;
+      *blocks += MIN(e->len, nblk - e->lblk);
+      // a run of disk blocks that follow each other counts as one extent
+      if (i == 0 || p->len == 0 || p->lblk + p->len != e->lblk || p->start + p->len != e->start) ++*extents;
+    }
+    return;
+  }
+  for (int i = 0; i < NDIRECT; ++i) {
+    if (di->addrs[i]) ++*blocks;
+  }
+  if (di->addrs[NDIRECT]) *blocks += ind_count(di->addrs[NDIRECT], 1);
+  if (di->addrs[NDIRECT + 1]) *blocks += ind_count(di->addrs[NDIRECT + 1], 2);
+}
+
+// as iblocks, but an addrs[] file is walked block by block for its runs
+static void iextents(dnode_t *inode, uint32_t *blocks, uint32_t *extents) {
+  uint32_t prev = 0, nblk = (inode->dinode.size + BLK_SIZE - 1) / BLK_SIZE;
+  if (inode->dinode.flags & (DI_INLINE | DI_EXTENT)) {
+    iblocks(inode, blocks, extents);
+    return;
+  }
+  *blocks = *extents = 0;
+  for (uint32_t i = 0; i < nblk; ++i) {
+    uint32_t blk = iwalk_disk(inode, i, 0);
+    if (blk) {
+      ++*blocks;
+      if (blk != prev + 1) ++*extents;
+    }
+    prev = blk;
+  }
 }
 
-static int idirempty(inode_t *inode) {
+static int idirempty(dnode_t *inode) {
   assert(inode->dinode.type == TYPE_DIR);
+  if (inode->dinode.dindex) {
+    uint32_t cnt;
+    bread(&cnt, 4, inode->dinode.dindex, 0);
+    return cnt == 2; // . and ..
+  }
   uint32_t size = inode->dinode.size;
   dirent_t dirent;
   for (uint32_t i = 0; i < size; i += sizeof(dirent_t)) {
-    iread(inode, i, &dirent, sizeof dirent);
+    iread_locked(inode, i, &dirent, sizeof dirent);
     if(dirent.inode == 0) continue;
     if(dirent.inode != 0 && (strcmp(dirent.name, ".") == 0 && i == 0)) continue;
     if(dirent.inode != 0 && (strcmp(dirent.name, "..") == 0 && (i == sizeof(dirent_t)))) continue;
@@ -514,42 +1241,358 @@ static int idirempty(inode_t *inode) {
   return true;
 }
 
-int iremove(const char *path) {
-  char name[MAX_NAME + 1];
+// The disk fs behind the VFS, see vfs.h for what each op promises
+
+static void *disk_mount(void *src) {
+  fs_mount(src);
+  return iget(sb.root);
+}
+
+static void *disk_lookup(void *node, const char *name, int type) {
+  dnode_t *dir = node, *ip = NULL;
+  fs_lock();
+  log_begin();
+  if (dir->dinode.type == TYPE_DIR) ip = ilookup(dir, name, NULL, type);
+  log_end(0); // a create commits with the close that follows
+  fs_unlock();
+  return ip;
+}
+
+static void *disk_dup(void *node) {
+  dnode_t *ip = node;
+  assert(ip->ref > 0);
+  ip->ref++;
+  return ip;
+}
+
+static void disk_close(void *node) {
+  dnode_t *ip = node;
+  fs_lock();
+  // the file is durable once closed, a dir closed on a walk commits nothing
+  int commit = ip->pending;
+  ip->pending = 0;
+  log_begin();
+  iclose_locked(ip);
+  log_end(commit);
+  fs_unlock();
+}
+
+static int disk_type(void *node) {
+  return ((dnode_t *)node)->dinode.type;
+}
+
+static uint32_t disk_no(void *node) {
+  return ((dnode_t *)node)->no;
+}
+
+static uint32_t disk_size(void *node) {
+  return ((dnode_t *)node)->dinode.size;
+}
+
+static int disk_devid(void *node) {
+  dnode_t *ip = node;
+  return ip->dinode.type == TYPE_DEV ? ip->dinode.device : -1;
+}
+
+static int disk_read(void *node, uint32_t off, void *buf, uint32_t len) {
+  fs_lock();
+  int ret = iread_locked(node, off, buf, len);
+  fs_unlock();
+  return ret;
+}
+
+static int disk_write(void *node, uint32_t off, const void *buf, uint32_t len) {
+  fs_lock();
+  log_begin();
+  ((dnode_t *)node)->pending = 1;
+  int ret = iwrite_locked(node, off, buf, len);
+  log_end(0);
+  fs_unlock();
+  return ret;
+}
+
+static int disk_truncate(void *node, uint32_t len) {
+  dnode_t *ip = node;
+  if (ip->dinode.type != TYPE_FILE) return -1;
+  fs_lock();
+  log_begin();
+  ip->pending = 1;
+  itruncate_locked(ip, len);
+  log_end(0);
+  fs_unlock();
+  return 0;
+}
+
+static int disk_allocate(void *node, uint32_t off, uint32_t len) {
+  dnode_t *ip = node;
+  if (ip->dinode.type != TYPE_FILE) return -1;
+  fs_lock();
+  log_begin();
+  ip->pending = 1;
+  int ret = iallocate_locked(ip, off, len);
+  log_end(0);
+  fs_unlock();
+  return ret;
+}
+
+static int disk_read_direct(void *node, uint32_t off, void *buf, uint32_t len) {
+  fs_lock();
+  int ret = iread_direct_locked(node, off, buf, len);
+  fs_unlock();
+  return ret;
+}
+
+static int disk_write_direct(void *node, uint32_t off, const void *buf, uint32_t len) {
+  fs_lock();
+  log_begin();
+  ((dnode_t *)node)->pending = 1;
+  int ret = iwrite_direct_locked(node, off, buf, len);
+  log_end(0);
+  fs_unlock();
+  return ret;
+}
+
+// the pieces of iov one after another from off on, under one lock
+static int disk_readv(void *node, uint32_t off, const struct iovec *iov, int cnt) {
+  fs_lock();
+  int ret = 0;
+  for (int i = 0; i < cnt; ++i) {
+    int rd = iread_locked(node, off + ret, iov[i].iov_base, iov[i].iov_len);
+    if (rd < 0) {
+      ret = ret ? ret : -1;
+      break;
+    }
+    ret += rd;
+    if (rd < iov[i].iov_len) break; // end of file
+  }
+  fs_unlock();
+  return ret;
+}
+
+// and in one log op, so the inode and bitmap blocks are logged once
+static int disk_writev(void *node, uint32_t off, const struct iovec *iov, int cnt) {
+  fs_lock();
+  log_begin();
+  ((dnode_t *)node)->pending = 1;
+  int ret = 0, n = 0;
+  // a short or failed piece ends it, the later ones would land past a gap
+  for (int i = 0; i < cnt; ++i) {
+    if ((n = iwrite_locked(node, off + ret, iov[i].iov_base, iov[i].iov_len)) < 0) break;
+    ret += n;
+    if (n < iov[i].iov_len) break;
+  }
+  if (ret == 0 && n < 0) ret = n;
+  log_end(0);
+  fs_unlock();
+  return ret;
+}
+
+#define COPY_BATCH MAX_RUN // pieces copied in one log op
+
+// len bytes of src from soff on go to dst at doff from buffer to buffer in
+// the cache; a hole or an inline side goes through a small bounce
+static int disk_copy(void *dnode, uint32_t doff, void *snode, uint32_t soff, uint32_t len) {
+  dnode_t *dst = dnode, *src = snode;
+  char bounce[SECTSIZE];
+  uint32_t n, from, to, ret;
+  if (dst->dinode.type != TYPE_FILE) return -1;
+  fs_lock();
+  len = soff < src->dinode.size ? MIN(len, src->dinode.size - soff) : 0;
+  if (doff + len < doff || (dst == src && soff < doff + len && doff < soff + len)) {
+    fs_unlock();
+    return -1; // past the largest size, or overlapping ranges of one file
+  }
+  ret = len;
+  dst->pending = 1;
+  while (len > 0) {
+    log_begin();
+    itouch(dst);
+    if ((dst->dinode.flags & DI_INLINE) && doff + len > INLINE_MAX) iunline(dst);
+    for (int i = 0; i < COPY_BATCH && len > 0; ++i) {
+      n = MIN(len, MIN(BLK_SIZE - soff % BLK_SIZE, BLK_SIZE - doff % BLK_SIZE));
+      to = from = 0;
+      // dst first, mapping it may move a delayed run of src
+      if (!(dst->dinode.flags & DI_INLINE)) {
+        to = iwalk(dst, doff / BLK_SIZE, MIN((doff + len - 1) / BLK_SIZE - doff / BLK_SIZE + 1, MAX_RUN));
+      }
+      if (!(src->dinode.flags & DI_INLINE)) from = iwalk(src, soff / BLK_SIZE, 0);
+      if (to && from) {
+        bcopy(to, doff % BLK_SIZE, from, soff % BLK_SIZE, n);
+        if (doff + n > dst->dinode.size) {
+          dst->dinode.size = doff + n;
+          dst->dirty = 1;
+        }
+      } else {
+        n = MIN(n, sizeof bounce);
+        iread_locked(src, soff, bounce, n);
+        iwrite_locked(dst, doff, bounce, n);
+      }
+      soff += n;
+      doff += n;
+      len -= n;
+    }
+    if (dst->dirty) iupdate(dst);
+    log_end(0);
+  }
+  fs_unlock();
+  return ret;
+}
+
+static void disk_trunc(void *node) {
+  fs_lock();
+  log_begin();
+  ((dnode_t *)node)->pending = 1;
+  itrunc_locked(node);
+  log_end(0);
+  fs_unlock();
+}
+
+static int disk_remove(void *node, const char *name) {
+  dnode_t *dir = node, *f;
   uint32_t offset;
   dirent_t dirent;
-  inode_t *ptr = iopen_parent(path, name);
-  if(ptr == NULL) return -1;
-  if(strcmp(name, ".") == 0) 
-    {
-      iclose(ptr);
-      return -1;
-    }
-  if(strcmp(name, "..") == 0)
-    {
-      iclose(ptr);
-      return -1;
-    }
-  
-  inode_t *f = ilookup(ptr, name, &offset, TYPE_NONE);
-  if(f == NULL)
-  {
-    iclose(ptr);
-    return -1;
+  int ret = -1;
+  if (dir->dinode.type != TYPE_DIR || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return -1;
+  fs_lock();
+  log_begin();
+  f = ilookup(dir, name, &offset, TYPE_NONE);
+  if (f && (f->dinode.type != TYPE_DIR || idirempty(f))) {
+    memset(&dirent, 0, sizeof(dirent_t));
+    f->del = 1;
+    iwrite_locked(dir, offset, &dirent, sizeof(dirent_t));
+    if (dir->dinode.dindex) idx_del(dir, name, offset);
+    dinsert(dir->no, name, 0, 0);
+    ret = 0;
   }
-  if(itype(f) == TYPE_DIR)
-  {
-    if(idirempty(f) == false) 
-      {
-        iclose(f);
-        iclose(ptr);
-        return -1;
-      }
+  if (f) iclose_locked(f); // freed now, or by the last close if still open
+  log_end(1);
+  fs_unlock();
+  return ret;
+}
+
+// devs show up as node 0 with no size, as in a directory listing
+static void disk_statx(dnode_t *inode, struct stat *st, int walk) {
+  fs_lock();
+  st->type = inode->dinode.type;
+  if (st->type == TYPE_DEV) {
+    st->node = st->size = st->blocks = st->extents = 0;
+  } else {
+    st->node = inode->no;
+    st->size = inode->dinode.size;
+    if (walk) iextents(inode, &st->blocks, &st->extents);
+    else iblocks(inode, &st->blocks, &st->extents);
   }
-  memset(&dirent, 0, sizeof(dirent_t));
-  f->del = 1;
-  iwrite(ptr, offset, &dirent, sizeof(dirent_t));
-  return 0;
+  st->mtime = inode->dinode.mtime;
+  st->ctime = inode->dinode.ctime;
+  fs_unlock();
+}
+
+static void disk_stat(void *node, struct stat *st) {
+  disk_statx(node, st, 0);
+}
+
+static void disk_extents(void *node, struct stat *st) {
+  disk_statx(node, st, 1);
+}
+
+#define DIR_BATCH 8 // dirents read at once, the kernel stack is small
+
+// up to n live entries from byte *off of dir on, *off moves past them
+static int disk_dirread(void *node, uint32_t *off, struct dirstat *ds, int n) {
+  dnode_t *dir = node;
+  if (dir->dinode.type != TYPE_DIR) return -1;
+  fs_lock();
+  dirent_t batch[DIR_BATCH];
+  int cnt = 0, got = 1;
+  while (cnt < n && got > 0) {
+    got = iread_locked(dir, *off, batch, sizeof batch) / sizeof(dirent_t);
+    for (int i = 0; i < got && cnt < n; ++i) {
+      *off += sizeof(dirent_t);
+      if (batch[i].inode == 0) continue;
+      dinode_t di;
+      diread(&di, batch[i].inode); // the inode block is most likely cached
+      ds[cnt].type = di.type;
+      // devices look as they do to fstat on an open one
+      ds[cnt].node = di.type == TYPE_DEV ? 0 : batch[i].inode;
+      ds[cnt].size = di.type == TYPE_DEV ? 0 : di.size;
+      strcpy(ds[cnt].name, batch[i].name);
+      cnt++;
+    }
+  }
+  fs_unlock();
+  return cnt;
 }
 
-#endif
+// the frame of page idx in the page cache for a user mapping to share, or
+// NULL if the page is not a whole block on disk, the caller copies it then
+static void *disk_map_page(void *node, uint32_t idx) {
+  dnode_t *inode = node;
+  void *frame = NULL;
+  fs_lock();
+  if (!(inode->dinode.flags & DI_INLINE) && (idx + 1) * BLK_SIZE <= inode->dinode.size) {
+    struct buf *b = pfind(inode, idx);
+    uint32_t no;
+    if (b == NULL && (no = iwalk(inode, idx, 0)) != 0 && no < BDELAY) {
+      b = bpage(no, inode, idx);
+      pinsert(inode, idx, b);
+    }
+    if (b) frame = bpage_map(b);
+  }
+  fs_unlock();
+  return frame;
+}
+
+// drops a mapping disk_map_page handed out, 0 if frame did not come from it
+static int disk_unmap_page(void *node, void *frame, int dirty) {
+  fs_lock();
+  log_begin();
+  int ret = bunmap(frame, dirty);
+  if (ret && dirty) {
+    ((dnode_t *)node)->pending = 1;
+    itouch(node);
+    iupdate(node);
+  }
+  log_end(0);
+  fs_unlock();
+  return ret;
+}
+
+static void disk_sync(void *node) {
+  // what a close would commit, without closing
+  dnode_t *ip = node;
+  fs_lock();
+  log_begin();
+  if (ip->dcnt && !ip->del) idelay_end(ip, 1);
+  ip->pending = 0;
+  log_end(1);
+  fs_unlock();
+}
+
+const fsops_t diskfs_ops = {
+  .name = "diskfs",
+  .mount = disk_mount,
+  .lookup = disk_lookup,
+  .dup = disk_dup,
+  .close = disk_close,
+  .type = disk_type,
+  .no = disk_no,
+  .size = disk_size,
+  .devid = disk_devid,
+  .read = disk_read,
+  .write = disk_write,
+  .trunc = disk_trunc,
+  .remove = disk_remove,
+  .stat = disk_stat,
+  .extents = disk_extents,
+  .dirread = disk_dirread,
+  .readv = disk_readv,
+  .writev = disk_writev,
+  .read_direct = disk_read_direct,
+  .write_direct = disk_write_direct,
+  .copy = disk_copy,
+  .map_page = disk_map_page,
+  .unmap_page = disk_unmap_page,
+  .sync = disk_sync,
+  .truncate = disk_truncate,
+  .allocate = disk_allocate,
+};
@@ -0,0 +1,133 @@
+#include "klib.h"
+#include "blk.h"
+
+// ATA PIO driver for up to four disks, master and slave on both channels
+
+#define ATA_BSY   0x80
+#define ATA_DRDY  0x40
+#define ATA_DF    0x20
+#define ATA_DRQ   0x08
+#define ATA_ERR   0x01
+
+#define ATA_CMD_READ  0x20
+#define ATA_CMD_WRITE 0x30
+#define ATA_CMD_FLUSH 0xe7
+#define ATA_CMD_IDENTIFY 0xec
+
+#define SECT_PER_BLK (BLK_SIZE / SECTSIZE)
+#define MAX_SECT     256 // one command transfers at most 256 sectors (count 0)
+
+#define NR_IDE 4
+
+typedef struct {
+  uint16_t port;
+  uint8_t sel; // drive/head register bits, 0xe0 master, 0xf0 slave
+} ide_t;
+
+static const uint16_t ide_port[2] = {0x1f0, 0x170};
+static ide_t ides[NR_IDE];
+static blkdev_t ide_devs[NR_IDE];
+
+static int ide_wait(ide_t *ide, int drq) {
+  uint8_t st;
+  while ((st = inb(ide->port + 7)) & ATA_BSY) ;
+  if (st & (ATA_ERR | ATA_DF)) return -1;
+  if (drq) while (!((st = inb(ide->port + 7)) & ATA_DRQ)) ;
+  return 0;
+}
+
+static void ide_cmd(ide_t *ide, uint32_t sect, int cnt, int cmd) {
+  outb(ide->port + 6, ((sect >> 24) & 0x0f) | ide->sel);
+  while ((inb(ide->port + 7) & (ATA_BSY | ATA_DRDY)) != ATA_DRDY) ;
+  outb(ide->port + 2, cnt % MAX_SECT);
+  outb(ide->port + 3, sect);
+  outb(ide->port + 4, sect >> 8);
+  outb(ide->port + 5, sect >> 16);
+  outb(ide->port + 7, cmd);
+}
+
+static int ide_read(blkdev_t *dev, void *buf, uint32_t no, uint32_t cnt) {
+  ide_t *ide = dev->priv;
+  uint32_t sect = no * SECT_PER_BLK, nsect = cnt * SECT_PER_BLK;
+  uint32_t *ptr = buf;
+  while (nsect > 0) {
+    int n = MIN(nsect, MAX_SECT);
+    ide_cmd(ide, sect, n, ATA_CMD_READ);
+    for (int i = 0; i < n; ++i) {
+      if (ide_wait(ide, 1) < 0) return -1;
+      for (int j = 0; j < SECTSIZE / 4; ++j) {
+        *ptr++ = inl(ide->port);
+      }
+    }
+    sect += n;
+    nsect -= n;
+  }
+  return 0;
+}
+
+static int ide_write(blkdev_t *dev, const void *buf, uint32_t no, uint32_t cnt) {
+  ide_t *ide = dev->priv;
+  uint32_t sect = no * SECT_PER_BLK, nsect = cnt * SECT_PER_BLK;
+  const uint32_t *ptr = buf;
+  while (nsect > 0) {
+    int n = MIN(nsect, MAX_SECT);
+    ide_cmd(ide, sect, n, ATA_CMD_WRITE);
+    for (int i = 0; i < n; ++i) {
+      if (ide_wait(ide, 1) < 0) return -1;
+      for (int j = 0; j < SECTSIZE / 4; ++j) {
+        outl(ide->port, *ptr++);
+      }
+    }
+    if (ide_wait(ide, 0) < 0) return -1;
+    sect += n;
+    nsect -= n;
+  }
+  return 0;
+}
+
+static int ide_flush(blkdev_t *dev) {
+  ide_t *ide = dev->priv;
+  ide_cmd(ide, 0, 0, ATA_CMD_FLUSH);
+  return ide_wait(ide, 0);
+}
+
+// returns the capacity in sectors, 0 if no ATA disk answers
+static uint32_t ide_identify(ide_t *ide) {
+  outb(ide->port + 6, ide->sel);
+  uint8_t st = inb(ide->port + 7);
+  if (st == 0xff || st == 0) return 0; // floating bus or no drive
+  outb(ide->port + 7, ATA_CMD_IDENTIFY);
+  while ((st = inb(ide->port + 7)) & ATA_BSY) ;
+  // ATAPI devices abort IDENTIFY and leave their signature in the LBA regs
+  if (st == 0 || inb(ide->port + 4) || inb(ide->port + 5)) return 0;
+  while (!((st = inb(ide->port + 7)) & (ATA_DRQ | ATA_ERR))) ;
+  if (st & ATA_ERR) return 0;
+  uint16_t id[SECTSIZE / 2];
+  for (int i = 0; i < SECTSIZE / 2; ++i) {
+    id[i] = inw(ide->port);
+  }
+  // words 60-61 hold the number of LBA28 sectors
+  return id[60] | ((uint32_t)id[61] << 16);
+}
+
+int ide_probe(blkdev_t *devs[]) {
+  int n = 0;
+  for (int i = 0; i < NR_IDE; ++i) {
+    ide_t *ide = &ides[i];
+    ide->port = ide_port[i / 2];
+    ide->sel = i % 2 ? 0xf0 : 0xe0;
+    uint32_t nsect = ide_identify(ide);
+    if (nsect == 0) continue;
+    blkdev_t *dev = &ide_devs[i];
+    sprintf(dev->name, "ide%d", i);
+    dev->nblk = nsect / SECT_PER_BLK;
+    dev->qdepth = 1;
+    dev->irq = -1; // polled, IRQ 14/15 are raised but nothing waits on them
+    dev->read = ide_read;
+    dev->write = ide_write;
+    dev->flush = ide_flush;
+    dev->priv = ide;
+    devs[n++] = dev;
+  }
+  return n;
+}
@@ -0,0 +1,166 @@
+#include "klib.h"
+#include "proc.h"
+#include "file.h"
+
+// Submission and completion rings. io_enter hands the sq entries the user
+// filled to a kernel thread of the proc, which runs in the proc's memory
+// with its fds and sleeps on the disk for them while the proc computes
+// on, so one trap starts a whole batch and need not wait for any of it.
+
+#define MAX_IORING 16
+
+struct ioring {
+  struct io_ring *u; // in the owner's memory
+  proc_t *owner, *worker;
+  uint32_t head;  // sq entries taken by the worker
+  uint32_t limit; // sq entries handed in
+  uint32_t tail;  // cq entries posted
+  int inflight;   // handed in and not posted yet
+  int idle;       // the worker sleeps on work
+  uint32_t want;  // cq entries the owner sleeps on done for, 0 if it doesn't
+  int stop;
+  sem_t work, done, gone;
+};
+
+static ioring_t rings[MAX_IORING];
+
+static int io_open(const char *path, int mode) {
+  proc_t *self = proc_curr(), *owner = self->owner;
+  // a relative path is from the owner's cwd as it is now
+  inode_t *cwd = self->cwd;
+  self->cwd = idup(owner->cwd);
+  if (cwd) iclose(cwd);
+  file_t *file = fopen(path, mode);
+  if (file == NULL) return -1;
+  // the owner may have taken fds while fopen slept
+  int fd = proc_allocfile(owner);
+  if (fd == -1) {
+    fclose(file);
+    return -1;
+  }
+  owner->files[fd] = file;
+  return fd;
+}
+
+static int io_user(const void *addr, uint32_t len) {
+  // is [addr, addr+len) in user memory, the kernel's below PHY_MEM is not
+  return (size_t)addr >= PHY_MEM && (size_t)addr <= USR_MEM && len <= USR_MEM - (size_t)addr;
+}
+
+static int io_do(struct io_sqe *sqe) {
+  proc_t *owner = proc_curr()->owner;
+  if (sqe->op == IORING_OP_NOP) return 0;
+  if (sqe->op == IORING_OP_OPEN) return io_user(sqe->addr, 1) ? io_open(sqe->addr, sqe->len) : -1;
+  if ((sqe->op == IORING_OP_READ || sqe->op == IORING_OP_WRITE) && !io_user(sqe->addr, sqe->len)) return -1;
+  file_t *file = proc_getfile(owner, sqe->fd);
+  if (file == NULL) return -1;
+  if (sqe->op == IORING_OP_CLOSE) {
+    owner->files[sqe->fd] = NULL;
+    fclose(file);
+    return 0;
+  }
+  // held, the owner may close the fd while this sleeps
+  int ret = -1;
+  fdup(file);
+  switch (sqe->op) {
+  case IORING_OP_READ:
+    if (sqe->off == IORING_OFF_CUR) ret = fread(file, sqe->addr, sqe->len);
+    else ret = fpread(file, sqe->addr, sqe->len, sqe->off);
+    break;
+  case IORING_OP_WRITE:
+    if (sqe->off == IORING_OFF_CUR) ret = fwrite(file, sqe->addr, sqe->len);
+    else ret = fpwrite(file, sqe->addr, sqe->len, sqe->off);
+    break;
+  case IORING_OP_FSYNC:
+    ret = fsync(file);
+    break;
+  }
+  fclose(file);
+  return ret;
+}
+
+static void io_worker() {
+  ioring_t *r = proc_curr()->ring;
+  while (!r->stop) {
+    if (r->head == r->limit) {
+      r->idle = 1;
+      sem_p(&r->work);
+      continue;
+    }
+    struct io_sqe sqe = r->u->sq[r->head % IORING_ENTRIES];
+    r->u->sq_head = ++r->head; // the slot is the user's again
+    int res = io_do(&sqe);
+    struct io_cqe *cqe = &r->u->cq[r->tail % IORING_ENTRIES];
+    cqe->data = sqe.data;
+    cqe->res = res;
+    r->u->cq_tail = ++r->tail;
+    r->inflight--;
+    if (r->want && (r->tail - r->u->cq_head >= r->want || r->inflight == 0)) {
+      r->want = 0;
+      sem_v(&r->done);
+    }
+  }
+  if (proc_curr()->cwd) iclose(proc_curr()->cwd);
+  sem_v(&r->gone);
+  proc_kexit();
+}
+
+int ioring_setup(proc_t *proc, struct io_ring *u) {
+  if (proc->ring || !io_user(u, sizeof(*u))) return -1;
+  ioring_t *r = NULL;
+  for (int i = 0; i < MAX_IORING && r == NULL; ++i) {
+    if (rings[i].owner == NULL) r = &rings[i];
+  }
+  if (r == NULL) return -1;
+  proc_t *worker = proc_kthread(proc, io_worker);
+  if (worker == NULL) return -1;
+  memset(r, 0, sizeof(*r));
+  r->u = u;
+  r->owner = proc;
+  r->worker = worker;
+  sem_init(&r->work, 0);
+  sem_init(&r->done, 0);
+  sem_init(&r->gone, 0);
+  u->sq_head = u->sq_tail = u->cq_head = u->cq_tail = 0;
+  proc->ring = worker->ring = r;
+  proc_addready(worker);
+  return 0;
+}
+
+int ioring_enter(proc_t *proc, int min_complete) {
+  // hands in the filled sq entries cq has room for the results of, the
+  // rest wait for a later call; returns how many went in
+  ioring_t *r = proc->ring;
+  if (r == NULL) return -1;
+  uint32_t filled = r->u->sq_tail - r->limit, unseen = r->tail - r->u->cq_head;
+  if (filled > IORING_ENTRIES - (r->limit - r->head) || unseen + r->inflight > IORING_ENTRIES) return -1;
+  uint32_t n = MIN(filled, IORING_ENTRIES - unseen - r->inflight);
+  r->limit += n;
+  r->inflight += n;
+  if (n && r->idle) {
+    r->idle = 0;
+    sem_v(&r->work);
+    // let it start the I/O before the proc goes back to computing
+    if (min_complete <= 0) proc_yield();
+  }
+  while (min_complete > 0 && r->tail - r->u->cq_head < (uint32_t)min_complete && r->inflight > 0) {
+    r->want = min_complete;
+    sem_p(&r->done);
+  }
+  return n;
+}
+
+void ioring_close(proc_t *proc) {
+  // what is in flight finishes, what is not yet taken is dropped
+  ioring_t *r = proc->ring;
+  if (r == NULL) return;
+  r->stop = 1;
+  if (r->idle) {
+    r->idle = 0;
+    sem_v(&r->work);
+  }
+  sem_p(&r->gone);
+  proc_free(r->worker); // gone runs on to proc_kexit without sleeping
+  proc->ring = NULL;
+  r->owner = NULL;
+}
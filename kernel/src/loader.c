@@ -4,21 +4,22 @@
 #include "loader.h"
 #include "disk.h"
 #include "fs.h"
+#include "proc.h"
 #include <elf.h>
 
-uint32_t load_elf(PD *pgdir, const char *name) {
-  //Before Load, we should store current pgdir by vm_curr
+uint32_t load_elf(PD *pgdir, const char *name, vma_t *vmas) {
+  // the whole pages of a read-only segment are mapped from the page cache,
+  // as private mappings of the file in vmas, only the others are copied
   Elf32_Ehdr elf;
   Elf32_Phdr ph;
-  inode_t *inode = iopen(name, TYPE_NONE);
-  if (!inode) return -1;
+  file_t *file = fopen(name, O_RDONLY);
+  if (!file) return -1;
+  inode_t *inode = file->inode;
   iread(inode, 0, &elf, sizeof(elf));
   if (*(uint32_t*)(&elf) != 0x464c457f) { // check ELF magic number
-    iclose(inode);
+    fclose(file);
     return -1;
   }
-    PD* curr_pgdir = vm_curr();
-    set_cr3(pgdir);//set the cr3
   //load different sections!
   for (int i = 0; i < elf.e_phnum; ++i) {
     iread(inode, elf.e_phoff + i * sizeof(ph), &ph, sizeof(ph));
@@ -30,19 +31,23 @@ uint32_t load_elf(PD *pgdir, const char *name) {
     uint32_t prot = 0;
     if((ph.p_flags & PF_W) != 0 ) prot = 7;//Writeable
     else prot = 5; //Read-Only
-    vm_map(pgdir, vaddr, memsz, prot);
-    void *paddr = vm_walk(pgdir, vaddr, prot);
-    assert(paddr != NULL);//Check the paddr is not NULL
-    iread(inode, offset, (void *)paddr, filesz);
-    memset((void *)((uint32_t)paddr + filesz), 0, memsz - filesz);
+    size_t shared = 0;
+    if (prot == 5 && ADDR2OFF(vaddr) == 0 && ADDR2OFF(offset) == 0 && PAGE_DOWN(filesz) &&
+        mmap_image(pgdir, vmas, vaddr, PAGE_DOWN(filesz), file, offset)) shared = PAGE_DOWN(filesz);
       // Lab1-4: Load segment to virtual memory
-    //  TODO();
+    for (size_t pg = PAGE_DOWN(vaddr) + shared; pg < PAGE_UP(vaddr + memsz); pg += PGSIZE) {
+      // a page two segments share is copied into once each
+      PTE *pte = vm_walkpte(pgdir, pg, prot);
+      if (!pte->present) pte->val = MAKE_PTE(kalloc(), prot);
+      pte->val |= prot;
+      size_t lo = MAX(pg, vaddr), hi = MIN(pg + PGSIZE, vaddr + filesz);
+      if (lo < hi) iread(inode, offset + (lo - vaddr), (char *)PTE2PG(*pte) + ADDR2OFF(lo), hi - lo);
+    }
     }
   }
   // TODO: Lab1-4 alloc stack memory in pgdir
   vm_map(pgdir, USR_MEM - PGSIZE, PGSIZE, 7);//kalloc the user stack!
-  iclose(inode);
-  set_cr3(curr_pgdir);//Return the current pgdir
+  fclose(file);
   return elf.e_entry;
 }
 
@@ -92,8 +97,8 @@ uint32_t load_arg(PD *pgdir, char *const argv[]) {
   return USR_MEM - PGSIZE + ADDR2OFF(stack_top);
 }
 
-int load_user(PD *pgdir, Context *ctx, const char *name, char *const argv[]) {
-  size_t eip = load_elf(pgdir, name);
+int load_user(PD *pgdir, Context *ctx, const char *name, char *const argv[], vma_t *vmas) {
+  size_t eip = load_elf(pgdir, name, vmas);
   if (eip == -1) return -1;
   ctx->cs = USEL(SEG_UCODE);
   ctx->ds = USEL(SEG_UDATA);
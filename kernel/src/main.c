@@ -7,18 +7,22 @@
 #include "proc.h"
 #include "timer.h"
 #include "dev.h"
+#include "blk.h"
+#include "vfs.h"
 
 void init_user_and_go();
 
 int main() {
   init_gdt();
   init_serial();
-  init_fs();
   init_page(); // uncomment me at Lab1-4
+  init_blk(); // a RAM disk needs kalloc
+  init_fs();
   init_cte(); // uncomment me at Lab1-5
   init_timer(); // uncomment me at Lab1-7
   init_proc(); // uncomment me at Lab2-1
   init_dev(); // uncomment me at Lab3-1
+  init_tmpfs();
   printf("Hello from OS!\n");
   init_user_and_go();
   panic("should never come back");
@@ -38,7 +42,7 @@ void init_user_and_go() {
 proc_t *proc = proc_alloc();
 assert(proc);
 char *argv[] = {"sh1", NULL};
-assert(load_user(proc->pgdir, proc->ctx, "sh1", argv) == 0);
+assert(load_user(proc->pgdir, proc->ctx, "sh1", argv, proc->vmas) == 0);
 proc_addready(proc);
 int cnt = 0;
 while (1) 
@@ -53,7 +57,7 @@ proc_t *proc = proc_alloc();
 proc->cwd = iopen("/", TYPE_NONE);
 assert(proc);
 char *argv[] = {"sh", NULL};
-assert(load_user(proc->pgdir, proc->ctx, "sh", argv) == 0);
+assert(load_user(proc->pgdir, proc->ctx, "sh", argv, proc->vmas) == 0);
 proc_addready(proc);
 sti();
 while (1) ;
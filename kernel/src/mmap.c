@@ -0,0 +1,223 @@
+#include "klib.h"
+#include "proc.h"
+
+#define PF_PRESENT 0x1 // errcode bits of a page fault
+#define PF_WRITE   0x2
+
+#define PTE_CACHE  0x200 // a free-for-software bit: the frame is a page cache one
+
+static vma_t *vma_find(proc_t *proc, size_t va) {
+  for (int i = 0; i < MAX_VMA; ++i) {
+    vma_t *v = &proc->vmas[i];
+    if (v->len && va >= v->start && va < v->start + v->len) return v;
+  }
+  return NULL;
+}
+
+static vma_t *vma_alloc(proc_t *proc) {
+  for (int i = 0; i < MAX_VMA; ++i) {
+    if (proc->vmas[i].len == 0) return &proc->vmas[i];
+  }
+  return NULL;
+}
+
+static int vma_free(proc_t *proc, size_t start, size_t len) {
+  // is [start, start+len) clear of the other mappings
+  if (start < MMAP_BASE || start + len > MMAP_TOP || start + len < start) return 0;
+  for (int i = 0; i < MAX_VMA; ++i) {
+    vma_t *v = &proc->vmas[i];
+    if (v->len && start < v->start + v->len && v->start < start + len) return 0;
+  }
+  return 1;
+}
+
+size_t mmap_map(proc_t *proc, size_t addr, size_t len, int prot, int flags, file_t *file, uint32_t off) {
+  // addr is a hint, the first gap that fits is taken when it does not
+  len = PAGE_UP(len);
+  vma_t *v = vma_alloc(proc);
+  if (v == NULL || len == 0) return (size_t)MAP_FAILED;
+  size_t start = PAGE_DOWN(addr);
+  if (!vma_free(proc, start, len)) {
+    start = MMAP_BASE;
+    for (int i = 0; i < MAX_VMA && !vma_free(proc, start, len); ++i) {
+      // skip past whichever mapping is in the way
+      for (int j = 0; j < MAX_VMA; ++j) {
+        vma_t *u = &proc->vmas[j];
+        if (u->len && start < u->start + u->len && u->start < start + len) start = u->start + u->len;
+      }
+    }
+    if (!vma_free(proc, start, len)) return (size_t)MAP_FAILED;
+  }
+  v->start = start;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->file = file ? fdup(file) : NULL;
+  v->off = off;
+  return start;
+}
+
+int mmap_image(PD *pgdir, vma_t *vmas, size_t start, size_t len, file_t *file, uint32_t off) {
+  // a read-only private mapping of an image being exec'd into pgdir, kept in
+  // vmas until the proc takes them; its pages are the page cache's frames
+  // from the start, one the cache can not pin comes in on the fault
+  vma_t *v = NULL;
+  for (int i = 0; i < MAX_VMA && v == NULL; ++i) {
+    if (vmas[i].len == 0) v = &vmas[i];
+  }
+  if (v == NULL) return 0;
+  v->start = start;
+  v->len = len;
+  v->prot = PROT_READ | PROT_EXEC;
+  v->flags = MAP_PRIVATE;
+  v->file = fdup(file);
+  v->off = off;
+  for (size_t pg = start; pg < start + len; pg += PGSIZE) {
+    void *page = imap_page(file->inode, (off + (pg - start)) / PGSIZE);
+    if (page) vm_walkpte(pgdir, pg, 7)->val = MAKE_PTE(page, PTE_P | PTE_U | PTE_CACHE);
+  }
+  return 1;
+}
+
+int mmap_covers(proc_t *proc, size_t va) {
+  return vma_find(proc, va) != NULL;
+}
+
+static void vma_drop(proc_t *proc, vma_t *v, size_t start, size_t end) {
+  // unmap the loaded pages of [start, end), a page cache frame stays in the
+  // cache, a dirty shared copy goes back to the file first, but never past
+  // its end
+  for (size_t pg = start; pg < end; pg += PGSIZE) {
+    PTE *pte = vm_walkpte(proc->pgdir, pg, 0);
+    if (pte == NULL || !pte->present) continue;
+    void *page = PTE2PG(*pte);
+    int dirty = (v->flags & MAP_SHARED) && pte->dirty;
+    if (!(pte->val & PTE_CACHE) || !iunmap_page(v->file->inode, page, dirty)) {
+      uint32_t pos = v->off + (pg - v->start), size = v->file ? isize(v->file->inode) : 0;
+      if (dirty && pos < size) iwrite(v->file->inode, pos, page, MIN(PGSIZE, size - pos));
+      kfree(page);
+    }
+    pte->val = 0;
+  }
+}
+
+int mmap_unmap(proc_t *proc, size_t addr, size_t len) {
+  if (ADDR2OFF(addr) || len == 0) return -1;
+  size_t end = PAGE_UP(addr + len);
+  for (int i = 0; i < MAX_VMA; ++i) {
+    // a hole in the middle of a mapping splits it in two
+    vma_t *v = &proc->vmas[i];
+    if (v->len && addr > v->start && end < v->start + v->len && vma_alloc(proc) == NULL) return -1;
+  }
+  for (int i = 0; i < MAX_VMA; ++i) {
+    vma_t *v = &proc->vmas[i];
+    size_t vend = v->start + v->len;
+    if (v->len == 0 || end <= v->start || vend <= addr) continue;
+    size_t s = MAX(addr, v->start), e = MIN(end, vend);
+    vma_drop(proc, v, s, e);
+    if (s == v->start && e == vend) {
+      if (v->file) fclose(v->file);
+      v->len = 0;
+    } else if (s == v->start) {
+      v->off += e - v->start;
+      v->start = e;
+      v->len = vend - e;
+    } else if (e == vend) {
+      v->len = s - v->start;
+    } else {
+      vma_t *w = vma_alloc(proc);
+      *w = *v;
+      w->start = e;
+      w->len = vend - e;
+      w->off += e - v->start;
+      if (w->file) fdup(w->file);
+      v->len = s - v->start;
+    }
+  }
+  if (proc == proc_curr()) flush_tlb();
+  return 0;
+}
+
+void mmap_unmapall(proc_t *proc) {
+  for (int i = 0; i < MAX_VMA; ++i) {
+    vma_t *v = &proc->vmas[i];
+    if (v->len) mmap_unmap(proc, v->start, v->len);
+  }
+}
+
+void mmap_dup(proc_t *dst, proc_t *src) {
+  // vm_copycurr leaves the mappings out: a loaded page of a shared mapping is
+  // the same frame in both, one of a private mapping goes read-only in both
+  // and the first write to it copies it
+  for (int i = 0; i < MAX_VMA; ++i) {
+    vma_t *v = &src->vmas[i];
+    dst->vmas[i] = *v;
+    if (v->len == 0) continue;
+    if (v->file) fdup(v->file);
+    for (size_t pg = v->start; pg < v->start + v->len; pg += PGSIZE) {
+      PTE *pte = vm_walkpte(src->pgdir, pg, 0);
+      if (pte == NULL || !pte->present) continue;
+      void *frame = PTE2PG(*pte);
+      if (!(v->flags & MAP_SHARED)) pte->val &= ~PTE_W;
+      if (pte->val & PTE_CACHE) {
+        void *got = imap_page(v->file->inode, (v->off + (pg - v->start)) / PGSIZE);
+        if (got != frame) {
+          // cut loose from the file by a truncate, the child gets its own
+          if (got) iunmap_page(v->file->inode, got, 0);
+          void *page = kalloc();
+          memcpy(page, frame, PGSIZE);
+          vm_walkpte(dst->pgdir, pg, 7)->val = MAKE_PTE(page, PTE_U | (pte->val & PTE_W));
+          continue;
+        }
+      } else {
+        kdup(frame);
+      }
+      PTE *cpte = vm_walkpte(dst->pgdir, pg, 7);
+      cpte->val = pte->val;
+      cpte->dirty = 0; // what the parent wrote goes back through the parent
+    }
+  }
+  if (src == proc_curr()) flush_tlb();
+}
+
+int mmap_fault(size_t va, int errcode) {
+  // load the page of a mapping at va, 0 if va is not in one or the access
+  // is not allowed
+  proc_t *proc = proc_curr();
+  if (proc->owner) proc = proc->owner; // a kernel thread in its memory
+  vma_t *v = vma_find(proc, va);
+  if (v == NULL) return 0;
+  if ((errcode & PF_WRITE) ? !(v->prot & PROT_WRITE) : !(v->prot & (PROT_READ | PROT_EXEC))) return 0;
+  size_t pg = PAGE_DOWN(va);
+  PTE *pte = vm_walkpte(proc->pgdir, pg, 7);
+  int shared = v->flags & MAP_SHARED, writable = v->prot & PROT_WRITE;
+  if (errcode & PF_PRESENT) {
+    // a write to a private page that still is the page cache's frame, or
+    // that a fork left in two memories
+    if (!(errcode & PF_WRITE) || shared || pte->read_write) return 0;
+    void *frame = PTE2PG(*pte), *page = frame;
+    if ((pte->val & PTE_CACHE) || kusers(frame) > 1) {
+      page = kalloc();
+      memcpy(page, frame, PGSIZE);
+      if (pte->val & PTE_CACHE) iunmap_page(v->file->inode, frame, 0);
+      else kfree(frame);
+    }
+    pte->val = MAKE_PTE(page, PTE_P | PTE_U | PTE_W);
+    flush_tlb();
+    return 1;
+  }
+  uint32_t pos = v->off + (pg - v->start);
+  void *page = NULL;
+  if (v->file && pos % PGSIZE == 0 && (shared || !writable || !(errcode & PF_WRITE))) {
+    // share the frame, a private one read-only until written
+    page = imap_page(v->file->inode, pos / PGSIZE);
+    if (page) {
+      pte->val = MAKE_PTE(page, PTE_P | PTE_U | PTE_CACHE | ((shared && writable) ? PTE_W : 0));
+      return 1;
+    }
+  }
+  page = kalloc(); // zeroed, so the part past the end of the file reads as 0
+  if (v->file) iread(v->file->inode, pos, page, PGSIZE);
+  pte->val = MAKE_PTE(page, PTE_P | PTE_U | (writable ? PTE_W : 0));
+  return 1;
+}
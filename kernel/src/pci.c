@@ -0,0 +1,42 @@
+#include "klib.h"
+#include "pci.h"
+
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+static uint32_t pci_addr(int bus, int slot, int func, int reg) {
+  return 0x80000000 | (bus << 16) | (slot << 11) | (func << 8) | (reg & 0xfc);
+}
+
+static uint32_t pci_conf_read(int bus, int slot, int func, int reg) {
+  outl(PCI_CONFIG_ADDR, pci_addr(bus, slot, func, reg));
+  return inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_read(pci_dev_t *dev, int reg) {
+  return pci_conf_read(dev->bus, dev->slot, dev->func, reg);
+}
+
+void pci_write(pci_dev_t *dev, int reg, uint32_t val) {
+  outl(PCI_CONFIG_ADDR, pci_addr(dev->bus, dev->slot, dev->func, reg));
+  outl(PCI_CONFIG_DATA, val);
+}
+
+int pci_find(uint16_t vendor, uint16_t device, int index, pci_dev_t *dev) {
+  // brute force scan of config space, only function 0 of each slot is probed
+  for (int bus = 0; bus < 256; ++bus) {
+    for (int slot = 0; slot < 32; ++slot) {
+      uint32_t id = pci_conf_read(bus, slot, 0, PCI_VENDOR);
+      if ((id & 0xffff) != vendor || (id >> 16) != device) continue;
+      if (index-- > 0) continue;
+      dev->bus = bus;
+      dev->slot = slot;
+      dev->func = 0;
+      dev->vendor = vendor;
+      dev->device = device;
+      dev->irq = pci_read(dev, PCI_INTLINE) & 0xff;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -43,6 +43,10 @@ proc_t *proc_alloc() {
       for (int j = 0 ; j <= MAX_UFILE - 1 ; j++)
         pcb[i].files[j] = NULL;
       pcb[i].cwd = NULL;
+      for (int j = 0 ; j <= MAX_VMA - 1 ; j++)
+        pcb[i].vmas[j].len = 0;
+      pcb[i].ring = NULL;
+      pcb[i].owner = NULL;
       return (proc_t *)(&pcb[i]);
     }
   }
@@ -53,6 +57,7 @@ proc_t *proc_alloc() {
 void proc_free(proc_t *proc) {
   // Lab2-1: free proc's pgdir and kstack and mark it UNUSED
   //TODO();
+  kfree(proc->kstack);
   proc->status = UNUSED;
 }
 
@@ -105,6 +110,7 @@ void proc_copycurr(proc_t *proc) {
   }
   // Lab3-2: dup cwd
   proc->cwd = idup(proc_curr()->cwd);
+  mmap_dup(proc, proc_curr());
   // TODO();
 }
 
@@ -123,6 +129,10 @@ void proc_makezombie(proc_t *proc, int exitcode) {
     if(proc->usems[i] != NULL)
       usem_close(proc->usems[i]);
   }
+  // the ring's thread works on the memory and files about to go
+  ioring_close(proc);
+  // shared mappings go back to their files
+  mmap_unmapall(proc);
   // Lab3-1: close opened files
   for (int i = 0 ; i <= MAX_UFILE - 1 ; i++)
   {
@@ -153,6 +163,29 @@ void proc_block() {
   INT(0x81);
 }
 
+proc_t *proc_kthread(proc_t *owner, void (*entry)()) {
+  // a proc that runs entry in the kernel on the memory of owner, with
+  // interrupts off like any kernel path, so it runs on until it sleeps
+  proc_t *proc = proc_alloc();
+  if (proc == NULL) return NULL;
+  kfree(proc->pgdir); // fresh from proc_alloc, nothing mapped in it yet
+  proc->pgdir = owner->pgdir;
+  proc->owner = owner;
+  proc->ctx->cs = KSEL(SEG_KCODE);
+  proc->ctx->ds = KSEL(SEG_KDATA);
+  proc->ctx->eip = (uint32_t)entry;
+  proc->ctx->eflags = 0x2;
+  return proc;
+}
+
+void proc_kexit() {
+  // a zombie no parent waits for, whoever started the thread frees it
+  // with proc_free once it is switched away from
+  curr->status = ZOMBIE;
+  INT(0x81);
+  panic("kernel thread back from the dead");
+}
+
 int proc_allocusem(proc_t *proc) {
   // Lab2-5: find a free slot in proc->usems, return its index, or -1 if none
   // TODO();
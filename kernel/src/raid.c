@@ -0,0 +1,93 @@
+#include "klib.h"
+#include "blk.h"
+
+// RAID-0: the array is cut into chunks dealt round-robin to the members.
+// Each member carries a label in its first block, which is array block
+// index * chunk, inside the boot area the fs never uses.
+
+#define RAID_MAGIC 0x30444152 // "RAD0"
+#define MAX_MEMBER 4
+
+typedef struct {
+  uint32_t magic;
+  uint32_t nmember;
+  uint32_t index; // position of this member
+  uint32_t chunk; // blocks per chunk
+  uint32_t nblk;  // blocks of the whole array
+} raid_label_t;
+
+typedef struct {
+  int n;
+  uint32_t chunk;
+  blkdev_t *member[MAX_MEMBER];
+} raid_t;
+
+static raid_t raid;
+
+static blkdev_t raid_dev = {
+  .name = "md0",
+  .irq = -1,
+  .priv = &raid,
+};
+
+static int raid_rw(blkdev_t *dev, void *buf, uint32_t no, uint32_t cnt, int write) {
+  raid_t *r = dev->priv;
+  while (cnt > 0) {
+    uint32_t chunk = no / r->chunk, off = no % r->chunk;
+    uint32_t n = MIN(cnt, r->chunk - off);
+    blkdev_t *m = r->member[chunk % r->n];
+    uint32_t mno = chunk / r->n * r->chunk + off;
+    int err = write ? blk_write(m, buf, mno, n) : blk_read(m, buf, mno, n);
+    if (err) return err;
+    buf += n * BLK_SIZE;
+    no += n;
+    cnt -= n;
+  }
+  return 0;
+}
+
+static int raid_read(blkdev_t *dev, void *buf, uint32_t no, uint32_t cnt) {
+  return raid_rw(dev, buf, no, cnt, 0);
+}
+
+static int raid_write(blkdev_t *dev, const void *buf, uint32_t no, uint32_t cnt) {
+  return raid_rw(dev, (void *)buf, no, cnt, 1);
+}
+
+static int raid_flush(blkdev_t *dev) {
+  raid_t *r = dev->priv;
+  for (int i = 0; i < r->n; ++i) {
+    if (blk_flush(r->member[i])) return -1;
+  }
+  return 0;
+}
+
+blkdev_t *raid0_assemble(blkdev_t *devs[], int n) {
+  static uint8_t blk[BLK_SIZE];
+  raid_label_t *lb = (raid_label_t *)blk, first = {0};
+  for (int i = 0; i < n; ++i) {
+    if (blk_read(devs[i], blk, 0, 1) || lb->magic != RAID_MAGIC) continue;
+    if (lb->nmember > MAX_MEMBER || lb->index >= lb->nmember) continue;
+    if (first.magic == 0) first = *lb;
+    if (lb->nmember != first.nmember || lb->chunk != first.chunk) continue;
+    raid.member[lb->index] = devs[i];
+  }
+  if (first.magic == 0) return NULL;
+  uint32_t mblk = -1;
+  for (int i = 0; i < first.nmember; ++i) {
+    if (raid.member[i] == NULL) {
+      printf("raid: member %d of %d missing\n", i, first.nmember);
+      return NULL;
+    }
+    mblk = MIN(mblk, raid.member[i]->nblk);
+  }
+  raid.n = first.nmember;
+  raid.chunk = first.chunk;
+  raid_dev.nblk = MIN(mblk / raid.chunk * raid.chunk * raid.n, first.nblk);
+  raid_dev.qdepth = raid.member[0]->qdepth * raid.n;
+  raid_dev.read = raid_read;
+  raid_dev.write = raid_write;
+  raid_dev.flush = raid_flush;
+  blk_register(&raid_dev);
+  return &raid_dev;
+}
@@ -29,6 +29,28 @@ void sem_v(sem_t *sem) {
   }
 }
 
+void rlock_init(rlock_t *lk) {
+  sem_init(&lk->sem, 1);
+  lk->owner = NULL;
+  lk->depth = 0;
+}
+
+void rlock_acquire(rlock_t *lk) {
+  if (lk->owner != proc_curr()) {
+    sem_p(&lk->sem);
+    lk->owner = proc_curr();
+  }
+  lk->depth++;
+}
+
+void rlock_release(rlock_t *lk) {
+  assert(lk->owner == proc_curr() && lk->depth > 0);
+  if (--lk->depth == 0) {
+    lk->owner = NULL;
+    sem_v(&lk->sem);
+  }
+}
+
 #define USER_SEM_NUM 128
 static usem_t user_sem[USER_SEM_NUM] __attribute__((used));
 
@@ -8,6 +8,7 @@
 #include "timer.h"
 #include "file.h"
 #include "fs.h"
+#include "blk.h"
 
 typedef int (*syshandle_t)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
 
@@ -90,9 +91,14 @@ int sys_exec(const char *path, char *const argv[]) {
  // TODO(); // Lab1-8, Lab2-1
   PD* pgdir = vm_alloc();
   Context ctx;
-  int ret = load_user(pgdir, &ctx, path, argv);
+  vma_t vmas[MAX_VMA] = {0};
+  int ret = load_user(pgdir, &ctx, path, argv, vmas);
   if(ret != 0) return -1;
   assert(ret == 0);
+  // the old image goes only now, after the new one has pinned what it shares
+  ioring_close(proc_curr()); // its thread works in the old pgdir
+  mmap_unmapall(proc_curr()); // from the old pgdir
+  memcpy(proc_curr()->vmas, vmas, sizeof(vmas));
   proc_curr()->pgdir = pgdir;
   set_cr3(pgdir);
   //Old proc will not be executed, so we don't need to set_tss
@@ -224,15 +230,15 @@ int sys_fstat(int fd, struct stat *st) {
  assert(file != NULL);
  if(file->type == TYPE_FILE || file->type == TYPE_DIR)
  { 
-  st->node = ino(file->inode);
-  st->size = isize(file->inode);
-  st->type = file->type;
+  ifstat(file->inode, st);
  }
  else if(file->type == TYPE_DEV)
  {
   st->node = 0;
   st->size = 0;
   st->type = TYPE_DEV;
+  st->blocks = st->extents = 0;
+  st->mtime = st->ctime = 0;
  }
  else assert(0);
  return 0;
@@ -259,12 +265,25 @@ int sys_unlink(const char *path) {
 
 // optional syscall
 
-void *sys_mmap() {
-  TODO();
+void *sys_mmap(const size_t *args) {
+  // addr, len, prot, flags, fd, off: six do not fit in the registers, so
+  // they come as an array like the old i386 mmap
+  size_t addr = args[0], len = args[1];
+  int prot = args[2], flags = args[3], fd = args[4];
+  uint32_t off = args[5];
+  file_t *file = NULL;
+  if (ADDR2OFF(off) || len == 0) return MAP_FAILED;
+  if (!(flags & MAP_SHARED) == !(flags & MAP_PRIVATE)) return MAP_FAILED;
+  if (!(flags & MAP_ANONYMOUS)) {
+    file = proc_getfile(proc_curr(), fd);
+    if (file == NULL || file->type != TYPE_FILE || !file->readable) return MAP_FAILED;
+    if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !file->writable) return MAP_FAILED;
+  }
+  return (void *)mmap_map(proc_curr(), addr, len, prot, flags, file, off);
 }
 
-void sys_munmap(void *addr) {
-  TODO();
+int sys_munmap(void *addr, size_t len) {
+  return mmap_unmap(proc_curr(), (size_t)addr, len);
 }
 
 int sys_clone(void (*entry)(void*), void *stack, void *arg) {
@@ -307,6 +326,96 @@ int sys_symlink(const char *oldpath, const char *newpath) {
   TODO();
 }
 
+int sys_iostat(int id, struct iostat *st) {
+  return blk_stat(id, st);
+}
+
+uint32_t sys_uptime() {
+  return get_tick();
+}
+
+int sys_getdents(int fd, struct dirstat *buf, uint32_t size) {
+  file_t *file = proc_getfile(proc_curr(), fd);
+  if(file == NULL) return -1;
+  return fgetdents(file, buf, size);
+}
+
+int sys_pread(int fd, void *buf, size_t count, uint32_t off) {
+  file_t *file = proc_getfile(proc_curr(), fd);
+  if(file == NULL) return -1;
+  return fpread(file, buf, count, off);
+}
+
+int sys_pwrite(int fd, const void *buf, size_t count, uint32_t off) {
+  file_t *file = proc_getfile(proc_curr(), fd);
+  if(file == NULL) return -1;
+  return fpwrite(file, buf, count, off);
+}
+
+int sys_readv(int fd, const struct iovec *iov, int cnt) {
+  file_t *file = proc_getfile(proc_curr(), fd);
+  if(file == NULL || cnt < 0 || cnt > IOV_MAX) return -1;
+  return freadv(file, iov, cnt);
+}
+
+int sys_writev(int fd, const struct iovec *iov, int cnt) {
+  file_t *file = proc_getfile(proc_curr(), fd);
+  if(file == NULL || cnt < 0 || cnt > IOV_MAX) return -1;
+  return fwritev(file, iov, cnt);
+}
+
+int sys_sendfile(int out_fd, int in_fd, uint32_t *off, uint32_t len) {
+  file_t *out = proc_getfile(proc_curr(), out_fd);
+  file_t *in = proc_getfile(proc_curr(), in_fd);
+  if(out == NULL || in == NULL) return -1;
+  return fsendfile(out, in, off, len);
+}
+
+int sys_copy_file_range(int in_fd, uint32_t *off_in, int out_fd, uint32_t *off_out, uint32_t len) {
+  file_t *in = proc_getfile(proc_curr(), in_fd);
+  file_t *out = proc_getfile(proc_curr(), out_fd);
+  if(in == NULL || out == NULL) return -1;
+  return fcopy_range(in, off_in, out, off_out, len);
+}
+
+int sys_io_setup(struct io_ring *ring) {
+  return ioring_setup(proc_curr(), ring);
+}
+
+int sys_io_enter(int min_complete) {
+  return ioring_enter(proc_curr(), min_complete);
+}
+
+int sys_ftruncate(int fd, uint32_t len) {
+  file_t *file = proc_getfile(proc_curr(), fd);
+  if(file == NULL) return -1;
+  return ftruncate(file, len);
+}
+
+int sys_fallocate(int fd, uint32_t off, uint32_t len) {
+  file_t *file = proc_getfile(proc_curr(), fd);
+  if(file == NULL) return -1;
+  return fallocate(file, off, len);
+}
+
+int sys_fextents(int fd, struct stat *st) {
+  file_t *file = proc_getfile(proc_curr(), fd);
+  if (file == NULL || (file->type != TYPE_FILE && file->type != TYPE_DIR)) return -1;
+  ifextents(file->inode, st);
+  return 0;
+}
+
+int sys_stat(const char *path, struct stat *st) {
+  return istat(NULL, path, st);
+}
+
+int sys_fstatat(int dirfd, const char *path, struct stat *st) {
+  if (dirfd == AT_FDCWD) return istat(NULL, path, st);
+  file_t *file = proc_getfile(proc_curr(), dirfd);
+  if (file == NULL || file->type != TYPE_DIR) return -1;
+  return istat(file->inode, path, st);
+}
+
 void *syscall_handle[NR_SYS] = {
   [SYS_write] = sys_write,
   [SYS_read] = sys_read,
@@ -340,4 +449,20 @@ void *syscall_handle[NR_SYS] = {
   [SYS_cv_close] = sys_cv_close,
   [SYS_pipe] = sys_pipe,
   [SYS_link] = sys_link,
-  [SYS_symlink] = sys_symlink};
+  [SYS_symlink] = sys_symlink,
+  [SYS_iostat] = sys_iostat,
+  [SYS_uptime] = sys_uptime,
+  [SYS_getdents] = sys_getdents,
+  [SYS_stat] = sys_stat,
+  [SYS_fstatat] = sys_fstatat,
+  [SYS_pread] = sys_pread,
+  [SYS_pwrite] = sys_pwrite,
+  [SYS_readv] = sys_readv,
+  [SYS_writev] = sys_writev,
+  [SYS_sendfile] = sys_sendfile,
+  [SYS_copy_file_range] = sys_copy_file_range,
+  [SYS_io_setup] = sys_io_setup,
+  [SYS_io_enter] = sys_io_enter,
+  [SYS_ftruncate] = sys_ftruncate,
+  [SYS_fallocate] = sys_fallocate,
+  [SYS_fextents] = sys_fextents};
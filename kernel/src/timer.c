@@ -7,6 +7,7 @@
 #define HZ 100
 
 static uint32_t tick;
+static uint32_t boot_time; // RTC time at tick 0, read on first use
 
 void init_timer() {
   int counter = FREQ_8253 / HZ;
@@ -23,3 +24,29 @@ void timer_handle() {
 uint32_t get_tick() {
   return tick;
 }
+
+#define CMOS_PORT 0x70
+
+static uint32_t cmos_read(int reg) {
+  outb(CMOS_PORT, reg);
+  return inb(CMOS_PORT + 1);
+}
+
+static uint32_t rtc_read() {
+  while (cmos_read(0x0a) & 0x80); // update in progress
+  uint32_t t[6] = {cmos_read(0x00), cmos_read(0x02), cmos_read(0x04),
+                   cmos_read(0x07), cmos_read(0x08), cmos_read(0x09)};
+  if (!(cmos_read(0x0b) & 0x04)) { // BCD
+    for (int i = 0; i < 6; ++i) t[i] = (t[i] >> 4) * 10 + (t[i] & 0xf);
+  }
+  // days since 1970-01-01, counting years from March so the leap day is last
+  uint32_t y = 2000 + t[5] - (t[4] <= 2), m = t[4], d = t[3];
+  uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  uint32_t days = y * 365 + y / 4 - y / 100 + y / 400 + doy - 719468;
+  return days * 86400 + t[2] * 3600 + t[1] * 60 + t[0];
+}
+
+uint32_t get_time() {
+  if (boot_time == 0) boot_time = rtc_read() - tick / HZ;
+  return boot_time + tick / HZ;
+}
@@ -0,0 +1,337 @@
+#include "klib.h"
+#include "vme.h"
+#include "timer.h"
+#include "vfs.h"
+
+// A file system in kernel memory for scratch files, mounted on /tmp.
+// Data and map pages come from kalloc and are kept on a free list of
+// their own once a file is truncated or removed, as kfree gives nothing
+// back.
+
+#define TMP_NMAP   16   // map pages a node has, each maps TMP_PERMAP data pages
+#define TMP_PAGES  8192 // pages tmpfs may take, 32 MiB
+#define TMP_PERMAP (PGSIZE / sizeof(void *))
+#define TMP_NO     0x40000000 // node nos from here on, clear of the disk's
+
+typedef struct tnode {
+  int type;
+  uint32_t no;
+  uint32_t size;
+  uint32_t npages; // data pages allocated
+  uint32_t mtime, ctime;
+  int ref;    // refs handed out
+  int linked; // still in its dir, freed once unlinked and closed
+  void **map[TMP_NMAP];
+  char name[MAX_NAME + 1];
+  struct tnode *parent, *child, *sibling;
+  struct tnode *next; // free list
+} tnode_t;
+
+static tnode_t troot;
+static tnode_t *tfree_nodes;
+static void *tfree_pages; // linked through their first word
+static uint32_t tpages;   // taken from kalloc so far
+static uint32_t tnext = TMP_NO;
+
+static void *tpage_alloc() {
+  void *pg = tfree_pages;
+  if (pg) {
+    tfree_pages = *(void **)pg;
+    memset(pg, 0, PGSIZE);
+    return pg;
+  }
+  if (tpages >= TMP_PAGES) return NULL;
+  tpages++;
+  return kalloc();
+}
+
+static void tpage_free(void *pg) {
+  *(void **)pg = tfree_pages;
+  tfree_pages = pg;
+}
+
+// data page idx of t, a fresh zeroed one if alloc, NULL for a hole
+static char *tpage(tnode_t *t, uint32_t idx, int alloc) {
+  uint32_t m = idx / TMP_PERMAP;
+  if (m >= TMP_NMAP) return NULL;
+  if (t->map[m] == NULL && (!alloc || (t->map[m] = tpage_alloc()) == NULL)) return NULL;
+  void **slot = &t->map[m][idx % TMP_PERMAP];
+  if (*slot == NULL && alloc && (*slot = tpage_alloc())) t->npages++;
+  return *slot;
+}
+
+static tnode_t *tnode_alloc(int type) {
+  if (tfree_nodes == NULL) {
+    tnode_t *page = kalloc();
+    for (int i = 0; i < PGSIZE / sizeof(tnode_t); ++i) {
+      page[i].next = tfree_nodes;
+      tfree_nodes = &page[i];
+    }
+  }
+  tnode_t *t = tfree_nodes;
+  tfree_nodes = t->next;
+  memset(t, 0, sizeof(*t));
+  t->type = type;
+  t->no = ++tnext;
+  t->ref = t->linked = 1;
+  t->mtime = t->ctime = get_time();
+  return t;
+}
+
+static void tmp_trunc_locked(tnode_t *t) {
+  for (int m = 0; m < TMP_NMAP; ++m) {
+    if (t->map[m] == NULL) continue;
+    for (int i = 0; i < TMP_PERMAP; ++i) {
+      if (t->map[m][i]) tpage_free(t->map[m][i]);
+    }
+    tpage_free(t->map[m]);
+    t->map[m] = NULL;
+  }
+  t->size = t->npages = 0;
+  t->mtime = t->ctime = get_time();
+}
+
+static tnode_t *tmp_get(tnode_t *t) {
+  t->ref++;
+  return t;
+}
+
+static void tmp_put(tnode_t *t) {
+  assert(t->ref > 0);
+  if (--t->ref > 0 || t->linked) return;
+  tnode_t *parent = t->parent;
+  tmp_trunc_locked(t);
+  t->next = tfree_nodes;
+  tfree_nodes = t;
+  if (parent) tmp_put(parent);
+}
+
+void init_tmpfs() {
+  assert(vfs_mount("/tmp", &tmpfs_ops, NULL) == 0);
+}
+
+static void *tmp_mount(void *src) {
+  // one instance, its root never freed
+  if (troot.type) return NULL;
+  troot.type = TYPE_DIR;
+  troot.no = TMP_NO;
+  troot.ref = troot.linked = 1;
+  troot.mtime = troot.ctime = get_time();
+  return &troot;
+}
+
+static void *tmp_dup(void *node) {
+  vfs_lock();
+  tmp_get(node);
+  vfs_unlock();
+  return node;
+}
+
+static void tmp_close(void *node) {
+  vfs_lock();
+  tmp_put(node);
+  vfs_unlock();
+}
+
+static int tmp_type(void *node) {
+  return ((tnode_t *)node)->type;
+}
+
+static uint32_t tmp_no(void *node) {
+  return ((tnode_t *)node)->no;
+}
+
+static uint32_t tmp_size(void *node) {
+  return ((tnode_t *)node)->size;
+}
+
+static int tmp_devid(void *node) {
+  return -1;
+}
+
+static tnode_t *tmp_lookup_locked(tnode_t *dir, const char *name, int type) {
+  if (dir->type != TYPE_DIR) return NULL;
+  if (strcmp(name, ".") == 0) return tmp_get(dir);
+  if (strcmp(name, "..") == 0) return tmp_get(dir->parent ? dir->parent : dir);
+  for (tnode_t *t = dir->child; t; t = t->sibling) {
+    if (strcmp(t->name, name) == 0) return tmp_get(t);
+  }
+  // no devs here, and nothing new in a removed dir
+  if (type == TYPE_NONE || type == TYPE_DEV || !dir->linked) return NULL;
+  tnode_t *t = tnode_alloc(type);
+  strcpy(t->name, name);
+  t->parent = tmp_get(dir); // for .., even once t is removed
+  t->sibling = dir->child;
+  dir->child = t;
+  dir->mtime = dir->ctime = t->ctime;
+  return t;
+}
+
+static void *tmp_lookup(void *dir, const char *name, int type) {
+  vfs_lock();
+  tnode_t *t = tmp_lookup_locked(dir, name, type);
+  vfs_unlock();
+  return t;
+}
+
+static int tmp_read(void *node, uint32_t off, void *buf, uint32_t len) {
+  tnode_t *t = node;
+  if (t->type == TYPE_DIR) return vfs_dirents(&tmpfs_ops, t, off, buf, len);
+  vfs_lock();
+  len = off < t->size ? MIN(len, t->size - off) : 0;
+  for (uint32_t done = 0, n; done < len; done += n) {
+    char *pg = tpage(t, (off + done) / PGSIZE, 0);
+    n = MIN(len - done, PGSIZE - (off + done) % PGSIZE);
+    if (pg) memcpy(buf + done, pg + (off + done) % PGSIZE, n);
+    else memset(buf + done, 0, n);
+  }
+  vfs_unlock();
+  return len;
+}
+
+static int tmp_write(void *node, uint32_t off, const void *buf, uint32_t len) {
+  tnode_t *t = node;
+  uint32_t done, n;
+  if (t->type != TYPE_FILE) return -1;
+  vfs_lock();
+  for (done = 0; done < len; done += n) {
+    char *pg = tpage(t, (off + done) / PGSIZE, 1);
+    if (pg == NULL) break; // out of pages, or past the largest file
+    n = MIN(len - done, PGSIZE - (off + done) % PGSIZE);
+    memcpy(pg + (off + done) % PGSIZE, buf + done, n);
+  }
+  if (done && off + done > t->size) t->size = off + done;
+  t->mtime = t->ctime = get_time();
+  vfs_unlock();
+  return done;
+}
+
+static void tmp_trunc(void *node) {
+  vfs_lock();
+  tmp_trunc_locked(node);
+  vfs_unlock();
+}
+
+static int tmp_truncate(void *node, uint32_t len) {
+  tnode_t *t = node;
+  if (t->type != TYPE_FILE) return -1;
+  vfs_lock();
+  uint32_t keep = (len + PGSIZE - 1) / PGSIZE;
+  for (uint32_t m = 0; len < t->size && m < TMP_NMAP; ++m) {
+    if (t->map[m] == NULL) continue;
+    for (uint32_t i = 0; i < TMP_PERMAP; ++i) {
+      void **slot = &t->map[m][i];
+      if (*slot == NULL || m * TMP_PERMAP + i < keep) continue;
+      tpage_free(*slot);
+      *slot = NULL;
+      t->npages--;
+    }
+    if (m * TMP_PERMAP >= keep) {
+      tpage_free(t->map[m]);
+      t->map[m] = NULL;
+    }
+  }
+  // the bytes past the end read as zero if it grows again
+  char *pg = len < t->size && len % PGSIZE ? tpage(t, len / PGSIZE, 0) : NULL;
+  if (pg) memset(pg + len % PGSIZE, 0, PGSIZE - len % PGSIZE);
+  t->size = len;
+  t->mtime = t->ctime = get_time();
+  vfs_unlock();
+  return 0;
+}
+
+static int tmp_allocate(void *node, uint32_t off, uint32_t len) {
+  tnode_t *t = node;
+  if (t->type != TYPE_FILE || off + len < off) return -1;
+  vfs_lock();
+  int ret = 0;
+  for (uint32_t idx = off / PGSIZE; ret == 0 && idx <= (off + len - 1) / PGSIZE; ++idx) {
+    if (tpage(t, idx, 1) == NULL) ret = -1; // out of pages, or past the largest file
+  }
+  if (ret == 0 && off + len > t->size) t->size = off + len;
+  t->ctime = get_time();
+  vfs_unlock();
+  return ret;
+}
+
+static int tmp_remove(void *node, const char *name) {
+  tnode_t *dir = node;
+  if (dir->type != TYPE_DIR) return -1;
+  vfs_lock();
+  tnode_t **pp = &dir->child;
+  while (*pp && strcmp((*pp)->name, name) != 0) pp = &(*pp)->sibling;
+  tnode_t *t = *pp;
+  int ret = -1;
+  if (t && (t->type != TYPE_DIR || t->child == NULL)) {
+    *pp = t->sibling;
+    t->linked = 0;
+    dir->mtime = dir->ctime = get_time();
+    tmp_put(tmp_get(t)); // freed unless still open
+    ret = 0;
+  }
+  vfs_unlock();
+  return ret;
+}
+
+// nothing of it is on disk, blocks counts the memory pages
+static void tmp_stat(void *node, struct stat *st) {
+  tnode_t *t = node;
+  st->type = t->type;
+  st->node = t->no;
+  st->size = t->size;
+  st->blocks = t->npages;
+  st->extents = 0;
+  st->mtime = t->mtime;
+  st->ctime = t->ctime;
+}
+
+// entry *off on is . then .. then the children, as a disk dir lists them
+static int tmp_dirread(void *node, uint32_t *off, struct dirstat *ds, int n) {
+  tnode_t *dir = node;
+  if (dir->type != TYPE_DIR) return -1;
+  vfs_lock();
+  int cnt = 0;
+  while (cnt < n) {
+    tnode_t *t = dir->child;
+    const char *name;
+    if (*off == 0) {
+      t = dir;
+      name = ".";
+    } else if (*off == 1) {
+      t = dir->parent ? dir->parent : dir;
+      name = "..";
+    } else {
+      for (uint32_t i = 2; t && i < *off; ++i) t = t->sibling;
+      if (t == NULL) break;
+      name = t->name;
+    }
+    ds[cnt].type = t->type;
+    ds[cnt].node = t->no;
+    ds[cnt].size = t->size;
+    strcpy(ds[cnt].name, name);
+    cnt++;
+    ++*off;
+  }
+  vfs_unlock();
+  return cnt;
+}
+
+const fsops_t tmpfs_ops = {
+  .name = "tmpfs",
+  .mount = tmp_mount,
+  .lookup = tmp_lookup,
+  .dup = tmp_dup,
+  .close = tmp_close,
+  .type = tmp_type,
+  .no = tmp_no,
+  .size = tmp_size,
+  .devid = tmp_devid,
+  .read = tmp_read,
+  .write = tmp_write,
+  .trunc = tmp_trunc,
+  .remove = tmp_remove,
+  .stat = tmp_stat,
+  .dirread = tmp_dirread,
+  .truncate = tmp_truncate,
+  .allocate = tmp_allocate,
+};
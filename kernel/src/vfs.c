@@ -0,0 +1,364 @@
+#include "klib.h"
+#include "vfs.h"
+#include "proc.h"
+#include "blk.h"
+
+// An inode is a ref to a node of some mounted fs. Each fs caches and
+// counts its own nodes, so two inodes of one file share the node.
+struct inode {
+  struct mount *mnt;
+  void *node;
+  int ref;
+  struct inode *next; // free list
+};
+
+// A mount puts the root of an fs over a dir of another, / covers none.
+// Mounts stay for good.
+typedef struct mount {
+  const fsops_t *ops;
+  void *root;
+  inode_t *on; // the dir it covers, held so its node stays the same
+} mount_t;
+
+#define MAX_MOUNT 8
+
+static mount_t mounts[MAX_MOUNT];
+static int nmount;
+static inode_t *ifree;
+
+#define BOUNCE 512 // bytes a copy across file systems moves at once
+
+// One sleep lock for all file systems. A copy to or from user memory
+// under it may fault on a page mapped from another fs, so a lock per fs
+// could be taken in opposite orders by two procs. It is recursive since
+// such a fault nests.
+static rlock_t vlock;
+
+void vfs_lock() {
+  rlock_acquire(&vlock);
+}
+
+void vfs_unlock() {
+  rlock_release(&vlock);
+}
+
+void init_fs() {
+  rlock_init(&vlock);
+  mounts[0].ops = &diskfs_ops;
+  mounts[0].root = diskfs_ops.mount(blk_root());
+  assert(mounts[0].root);
+  nmount = 1;
+}
+
+static inode_t *vget(mount_t *mnt, void *node) {
+  // a dir something is mounted on stands for the root of that mount
+  for (int i = 1; i < nmount; ++i) {
+    mount_t *m = &mounts[i];
+    if (m->on->mnt == mnt && m->on->node == node) {
+      mnt->ops->close(node);
+      mnt = m;
+      node = m->ops->dup(m->root);
+      i = 0; // one may be stacked on it
+    }
+  }
+  if (ifree == NULL) {
+    inode_t *page = kalloc();
+    for (int i = 0; i < PGSIZE / sizeof(inode_t); ++i) {
+      page[i].next = ifree;
+      ifree = &page[i];
+    }
+  }
+  inode_t *ip = ifree;
+  ifree = ip->next;
+  ip->mnt = mnt;
+  ip->node = node;
+  ip->ref = 1;
+  return ip;
+}
+
+static int vroot(inode_t *ip) {
+  // the root of a mount other than /
+  return ip->mnt->on && ip->node == ip->mnt->root;
+}
+
+static const char* skipelem(const char *path, char *name) {
+  const char *s;
+  int len;
+  while (*path == '/') path++;
+  if (*path == 0) return 0;
+  s = path;
+  while(*path != '/' && *path != 0) path++;
+  len = path - s;
+  if (len >= MAX_NAME) {
+    memcpy(name, s, MAX_NAME);
+    name[MAX_NAME] = 0;
+  } else {
+    memcpy(name, s, len);
+    name[len] = 0;
+  }
+  while (*path == '/') path++;
+  return path;
+}
+
+static inode_t *vstep(inode_t *dir, const char *name, int type) {
+  // .. of a mount root is .. of the dir it covers
+  if (vroot(dir) && strcmp(name, "..") == 0) return vstep(dir->mnt->on, name, TYPE_NONE);
+  void *node = dir->mnt->ops->lookup(dir->node, name, type);
+  return node ? vget(dir->mnt, node) : NULL;
+}
+
+// a relative path starts at at, or at the cwd if at is NULL
+static inode_t *vparent(inode_t *at, const char *path, char *name) {
+  inode_t *ip, *next;
+  if (path[0] == '/') {
+    ip = vget(&mounts[0], mounts[0].ops->dup(mounts[0].root));
+  } else {
+    ip = idup(at ? at : proc_curr()->cwd);
+  }
+  while ((path = skipelem(path, name))) {
+    if (itype(ip) != TYPE_DIR) break;
+    if (*path == 0) return ip;
+    next = vstep(ip, name, TYPE_NONE);
+    iclose(ip);
+    if ((ip = next) == NULL) return NULL;
+  }
+  iclose(ip);
+  return NULL;
+}
+
+static inode_t *vopen(inode_t *at, const char *path, int type) {
+  char name[MAX_NAME + 1];
+  if (skipelem(path, name) == NULL) {
+    return path[0] == '/' ? vget(&mounts[0], mounts[0].ops->dup(mounts[0].root)) : NULL;
+  }
+  inode_t *dir = vparent(at, path, name);
+  if (dir == NULL) return NULL;
+  inode_t *ip = vstep(dir, name, type);
+  iclose(dir);
+  return ip;
+}
+
+// ops goes on the dir at path, made if missing; not on / or another mount
+int vfs_mount(const char *path, const fsops_t *ops, void *src) {
+  if (nmount == MAX_MOUNT) return -1;
+  inode_t *on = vopen(NULL, path, TYPE_DIR);
+  if (on == NULL) return -1;
+  // closed once, which commits the dir if it was just made
+  iclose(on);
+  if ((on = vopen(NULL, path, TYPE_NONE)) == NULL) return -1;
+  if (itype(on) != TYPE_DIR || vroot(on) || on->node == mounts[0].root ||
+      (mounts[nmount].root = ops->mount(src)) == NULL) {
+    iclose(on);
+    return -1;
+  }
+  mounts[nmount].ops = ops;
+  mounts[nmount].on = on;
+  nmount++;
+  return 0;
+}
+
+// dir read as whole dirents, for an fs whose dirs are not stored as such
+int vfs_dirents(const fsops_t *ops, void *dir, uint32_t off, void *buf, uint32_t len) {
+  struct dirstat ds;
+  dirent_t *de = buf;
+  uint32_t pos = off / sizeof(dirent_t), n = 0;
+  if (off % sizeof(dirent_t)) return 0;
+  for (; (n + 1) * sizeof(dirent_t) <= len && ops->dirread(dir, &pos, &ds, 1) == 1; ++n) {
+    de[n].inode = ds.node;
+    strcpy(de[n].name, ds.name);
+  }
+  return n * sizeof(dirent_t);
+}
+
+inode_t *iopen(const char *path, int type) {
+  return vopen(NULL, path, type);
+}
+
+// a mount root has the no of the dir it covers, so pwd finds it by name;
+// the no of its . if dot, else of its ..
+static uint32_t vrootno(inode_t *dir, int dot) {
+  if (dot) return ino(dir->mnt->on);
+  inode_t *up = vstep(dir, "..", TYPE_NONE);
+  uint32_t no = ino(up);
+  iclose(up);
+  return no;
+}
+
+int iread(inode_t *inode, uint32_t off, void *buf, uint32_t len) {
+  int ret = inode->mnt->ops->read(inode->node, off, buf, len);
+  if (vroot(inode) && ret > 0 && off % sizeof(dirent_t) == 0) {
+    // a dir lists . and .. first
+    dirent_t *de = buf;
+    for (uint32_t i = off / sizeof(dirent_t), n = 0; i < 2 && (n + 1) * sizeof(dirent_t) <= ret; ++i, ++n) {
+      de[n].inode = vrootno(inode, i == 0);
+    }
+  }
+  return ret;
+}
+
+int iwrite(inode_t *inode, uint32_t off, const void *buf, uint32_t len) {
+  return inode->mnt->ops->write(inode->node, off, buf, len);
+}
+
+int ireadv(inode_t *inode, uint32_t off, const struct iovec *iov, int cnt) {
+  const fsops_t *ops = inode->mnt->ops;
+  if (ops->readv) return ops->readv(inode->node, off, iov, cnt);
+  int ret = 0;
+  for (int i = 0; i < cnt; ++i) {
+    int rd = ops->read(inode->node, off + ret, iov[i].iov_base, iov[i].iov_len);
+    if (rd < 0) return ret ? ret : -1;
+    ret += rd;
+    if (rd < iov[i].iov_len) break; // end of file
+  }
+  return ret;
+}
+
+int iwritev(inode_t *inode, uint32_t off, const struct iovec *iov, int cnt) {
+  const fsops_t *ops = inode->mnt->ops;
+  if (ops->writev) return ops->writev(inode->node, off, iov, cnt);
+  int ret = 0;
+  for (int i = 0; i < cnt; ++i) {
+    int wr = ops->write(inode->node, off + ret, iov[i].iov_base, iov[i].iov_len);
+    if (wr < 0) return ret ? ret : -1;
+    ret += wr;
+    if (wr < iov[i].iov_len) break; // out of space
+  }
+  return ret;
+}
+
+// an fs without a cache of its own has nothing to go around
+int iread_direct(inode_t *inode, uint32_t off, void *buf, uint32_t len) {
+  const fsops_t *ops = inode->mnt->ops;
+  if (ops->read_direct) return ops->read_direct(inode->node, off, buf, len);
+  return iread(inode, off, buf, len);
+}
+
+int iwrite_direct(inode_t *inode, uint32_t off, const void *buf, uint32_t len) {
+  const fsops_t *ops = inode->mnt->ops;
+  if (ops->write_direct) return ops->write_direct(inode->node, off, buf, len);
+  return iwrite(inode, off, buf, len);
+}
+
+int icopy(inode_t *dst, uint32_t doff, inode_t *src, uint32_t soff, uint32_t len) {
+  if (itype(dst) != TYPE_FILE) return -1;
+  if (dst->mnt == src->mnt && dst->mnt->ops->copy) {
+    return dst->mnt->ops->copy(dst->node, doff, src->node, soff, len);
+  }
+  // across file systems through a small bounce
+  char bounce[BOUNCE];
+  uint32_t size = isize(src), ret;
+  int n;
+  len = soff < size ? MIN(len, size - soff) : 0;
+  if (dst->node == src->node && soff < doff + len && doff < soff + len) return -1;
+  for (ret = 0; ret < len; ret += n) {
+    n = iread(src, soff + ret, bounce, MIN(len - ret, BOUNCE));
+    if (n <= 0 || iwrite(dst, doff + ret, bounce, n) != n) break;
+  }
+  return ret;
+}
+
+void *imap_page(inode_t *inode, uint32_t idx) {
+  const fsops_t *ops = inode->mnt->ops;
+  return ops->map_page ? ops->map_page(inode->node, idx) : NULL;
+}
+
+int iunmap_page(inode_t *inode, void *frame, int dirty) {
+  const fsops_t *ops = inode->mnt->ops;
+  return ops->unmap_page ? ops->unmap_page(inode->node, frame, dirty) : 0;
+}
+
+void itrunc(inode_t *inode) {
+  inode->mnt->ops->trunc(inode->node);
+}
+
+int itruncate(inode_t *inode, uint32_t len) {
+  const fsops_t *ops = inode->mnt->ops;
+  if (ops->truncate) return ops->truncate(inode->node, len);
+  if (len) return -1;
+  ops->trunc(inode->node);
+  return 0;
+}
+
+int iallocate(inode_t *inode, uint32_t off, uint32_t len) {
+  const fsops_t *ops = inode->mnt->ops;
+  return ops->allocate ? ops->allocate(inode->node, off, len) : -1;
+}
+
+void isync(inode_t *inode) {
+  // a fs in memory has nothing to make durable
+  const fsops_t *ops = inode->mnt->ops;
+  if (ops->sync) ops->sync(inode->node);
+}
+
+inode_t *idup(inode_t *inode) {
+  assert(inode && inode->ref > 0);
+  inode->ref++;
+  return inode;
+}
+
+void iclose(inode_t *inode) {
+  assert(inode && inode->ref > 0);
+  if (--inode->ref > 0) return;
+  inode->mnt->ops->close(inode->node);
+  inode->next = ifree;
+  ifree = inode;
+}
+
+uint32_t isize(inode_t *inode) {
+  return inode->mnt->ops->size(inode->node);
+}
+
+int itype(inode_t *inode) {
+  return inode->mnt->ops->type(inode->node);
+}
+
+uint32_t ino(inode_t *inode) {
+  return vroot(inode) ? vrootno(inode, 1) : inode->mnt->ops->no(inode->node);
+}
+
+int idevid(inode_t *inode) {
+  return inode->mnt->ops->devid(inode->node);
+}
+
+int idirread(inode_t *dir, uint32_t *off, struct dirstat *ds, int n) {
+  int cnt = dir->mnt->ops->dirread(dir->node, off, ds, n);
+  for (int i = 0; i < cnt && vroot(dir); ++i) {
+    if (strcmp(ds[i].name, ".") == 0 || strcmp(ds[i].name, "..") == 0) {
+      ds[i].node = vrootno(dir, ds[i].name[1] == 0);
+    }
+  }
+  return cnt;
+}
+
+void ifstat(inode_t *inode, struct stat *st) {
+  inode->mnt->ops->stat(inode->node, st);
+  st->node = ino(inode);
+}
+
+void ifextents(inode_t *inode, struct stat *st) {
+  const fsops_t *ops = inode->mnt->ops;
+  (ops->extents ? ops->extents : ops->stat)(inode->node, st);
+  st->node = ino(inode);
+}
+
+int istat(inode_t *at, const char *path, struct stat *st) {
+  inode_t *ip = vopen(at, path, TYPE_NONE);
+  if (ip == NULL) return -1;
+  ifstat(ip, st);
+  iclose(ip);
+  return 0;
+}
+
+int iremove(const char *path) {
+  char name[MAX_NAME + 1];
+  inode_t *dir = vparent(NULL, path, name), *ip;
+  if (dir == NULL) return -1;
+  int ret = -1;
+  // a dir something is mounted on is busy
+  if ((ip = vstep(dir, name, TYPE_NONE)) != NULL) {
+    if (ip->mnt == dir->mnt) ret = dir->mnt->ops->remove(dir->node, name);
+    iclose(ip);
+  }
+  iclose(dir);
+  return ret;
+}
@@ -0,0 +1,219 @@
+#include "klib.h"
+#include "blk.h"
+#include "pci.h"
+#include "sem.h"
+#include "proc.h"
+
+// Legacy (virtio 0.9.5) virtio-blk over PCI, one split virtqueue.
+// Every request is a 3-descriptor chain: header, data, status byte.
+
+#define VIRTIO_VENDOR  0x1af4
+#define VIRTIO_BLK_DEV 0x1001 // transitional virtio-blk
+
+// legacy I/O BAR0 registers
+#define VIO_DEV_FEATURES 0x00
+#define VIO_DRV_FEATURES 0x04
+#define VIO_QUEUE_PFN    0x08
+#define VIO_QUEUE_SIZE   0x0c
+#define VIO_QUEUE_SEL    0x0e
+#define VIO_QUEUE_NOTIFY 0x10
+#define VIO_STATUS       0x12
+#define VIO_ISR          0x13
+#define VIO_CONFIG       0x14 // device config when MSI-X is off
+
+#define VIO_S_ACK       1
+#define VIO_S_DRIVER    2
+#define VIO_S_DRIVER_OK 4
+#define VIO_S_FAILED    128
+
+#define VRING_F_NEXT  1
+#define VRING_F_WRITE 2 // device writes this buffer
+
+#define VIRTIO_BLK_T_IN  0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+
+#define VIRTIO_BLK_F_FLUSH (1 << 9)
+
+#define VQ_MAX   256 // largest queue the static ring memory can hold
+#define NR_VREQ  32  // max outstanding requests
+
+typedef struct {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} vring_desc_t;
+
+typedef struct {
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[];
+} vring_avail_t;
+
+typedef struct {
+  uint32_t id;
+  uint32_t len;
+} vring_used_elem_t;
+
+typedef struct {
+  uint16_t flags;
+  uint16_t idx;
+  vring_used_elem_t ring[];
+} vring_used_t;
+
+typedef struct {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+} vblk_hdr_t;
+
+typedef struct {
+  vblk_hdr_t hdr;
+  volatile uint8_t status;
+  volatile int done;
+  sem_t sem;
+} vreq_t;
+
+static uint8_t vq_mem[3 * PGSIZE] PG_ALIGN;
+static vring_desc_t *desc;
+static vring_avail_t *avail;
+static volatile vring_used_t *used;
+static uint16_t qsz, last_used;
+
+static vreq_t vreqs[NR_VREQ];
+static int vreq_busy[NR_VREQ];
+static sem_t vreq_free; // counts free request slots
+
+static pci_dev_t pci;
+static int iobase;
+
+#define mb() asm volatile ("lock; addl $0, (%%esp)" ::: "memory")
+
+// a proc can sleep until the interrupt comes, the boot proc has to poll
+static int can_sleep() {
+  return proc_curr()->pid != 0;
+}
+
+static void virtio_reap() {
+  while (last_used != used->idx) {
+    mb();
+    uint32_t id = used->ring[last_used % qsz].id;
+    vreq_t *req = &vreqs[id / 3];
+    req->done = 1;
+    sem_v(&req->sem);
+    last_used++;
+  }
+}
+
+static void virtio_intr(blkdev_t *dev) {
+  inb(iobase + VIO_ISR); // reading ISR acks the interrupt
+  uint16_t old = last_used;
+  virtio_reap();
+  // don't let the woken proc wait for the next tick if we are idle
+  if (old != last_used && proc_curr()->pid == 0) proc_yield();
+}
+
+static uint32_t features;
+
+static int virtio_rw(void *buf, uint32_t no, uint32_t cnt, int type) {
+  sem_p(&vreq_free);
+  int slot = 0;
+  while (vreq_busy[slot]) slot++;
+  vreq_busy[slot] = 1;
+  vreq_t *req = &vreqs[slot];
+  req->hdr.type = type;
+  req->hdr.reserved = 0;
+  req->hdr.sector = (uint64_t)no * (BLK_SIZE / SECTSIZE);
+  req->status = 0xff;
+  req->done = 0;
+  sem_init(&req->sem, 0);
+
+  int d = slot * 3; // descriptors are statically owned by slots
+  desc[d].addr = (uint32_t)&req->hdr;
+  desc[d].len = sizeof(vblk_hdr_t);
+  desc[d].flags = VRING_F_NEXT;
+  desc[d].next = cnt ? d + 1 : d + 2; // a flush carries no data
+  desc[d + 1].addr = (uint32_t)buf;
+  desc[d + 1].len = cnt * BLK_SIZE;
+  desc[d + 1].flags = VRING_F_NEXT | (type == VIRTIO_BLK_T_IN ? VRING_F_WRITE : 0);
+  desc[d + 1].next = d + 2;
+  desc[d + 2].addr = (uint32_t)&req->status;
+  desc[d + 2].len = 1;
+  desc[d + 2].flags = VRING_F_WRITE;
+  desc[d + 2].next = 0;
+
+  avail->ring[avail->idx % qsz] = d;
+  mb();
+  avail->idx++;
+  mb();
+  outw(iobase + VIO_QUEUE_NOTIFY, 0);
+
+  if (can_sleep()) {
+    sem_p(&req->sem);
+  } else {
+    while (!req->done) {
+      inb(iobase + VIO_ISR);
+      virtio_reap();
+    }
+  }
+  int ret = req->status == 0 ? 0 : -1;
+  vreq_busy[slot] = 0;
+  sem_v(&vreq_free);
+  return ret;
+}
+
+static int virtio_read(blkdev_t *dev, void *buf, uint32_t no, uint32_t cnt) {
+  return virtio_rw(buf, no, cnt, VIRTIO_BLK_T_IN);
+}
+
+static int virtio_write(blkdev_t *dev, const void *buf, uint32_t no, uint32_t cnt) {
+  return virtio_rw((void *)buf, no, cnt, VIRTIO_BLK_T_OUT);
+}
+
+static int virtio_flush(blkdev_t *dev) {
+  // without the feature the device has no volatile write cache
+  if (!(features & VIRTIO_BLK_F_FLUSH)) return 0;
+  return virtio_rw(NULL, 0, 0, VIRTIO_BLK_T_FLUSH);
+}
+
+static blkdev_t virtio_dev = {
+  .name = "virtio0",
+  .qdepth = NR_VREQ,
+  .read = virtio_read,
+  .write = virtio_write,
+  .flush = virtio_flush,
+  .intr = virtio_intr,
+};
+
+blkdev_t *virtio_probe() {
+  if (pci_find(VIRTIO_VENDOR, VIRTIO_BLK_DEV, 0, &pci) < 0) return NULL;
+  pci_write(&pci, PCI_COMMAND, pci_read(&pci, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MASTER);
+  iobase = pci_read(&pci, PCI_BAR0) & ~3;
+
+  outb(iobase + VIO_STATUS, 0); // reset
+  outb(iobase + VIO_STATUS, VIO_S_ACK);
+  outb(iobase + VIO_STATUS, VIO_S_ACK | VIO_S_DRIVER);
+  features = inl(iobase + VIO_DEV_FEATURES) & VIRTIO_BLK_F_FLUSH;
+  outl(iobase + VIO_DRV_FEATURES, features);
+
+  outw(iobase + VIO_QUEUE_SEL, 0);
+  qsz = inw(iobase + VIO_QUEUE_SIZE);
+  if (qsz == 0 || qsz > VQ_MAX || qsz < NR_VREQ * 3) {
+    outb(iobase + VIO_STATUS, VIO_S_FAILED);
+    return NULL;
+  }
+  // legacy layout: desc | avail, then used on the next page boundary
+  memset(vq_mem, 0, sizeof(vq_mem));
+  desc = (vring_desc_t *)vq_mem;
+  avail = (vring_avail_t *)(vq_mem + qsz * sizeof(vring_desc_t));
+  used = (vring_used_t *)(vq_mem + PAGE_UP(qsz * sizeof(vring_desc_t) + (3 + qsz) * sizeof(uint16_t)));
+  outl(iobase + VIO_QUEUE_PFN, (uint32_t)vq_mem >> PGBITS);
+  last_used = 0;
+
+  sem_init(&vreq_free, NR_VREQ);
+  virtio_dev.irq = pci.irq;
+  virtio_dev.nblk = inl(iobase + VIO_CONFIG) / (BLK_SIZE / SECTSIZE); // low half of capacity
+  outb(iobase + VIO_STATUS, VIO_S_ACK | VIO_S_DRIVER | VIO_S_DRIVER_OK);
+  return &virtio_dev;
+}
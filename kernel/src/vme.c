@@ -28,6 +28,7 @@ page_t* free_page_list;
 static PD kpd;
 static PT kpt[PHY_MEM / PT_SIZE] __attribute__((used));
 static void *heap_ptr;
+static uint8_t pgref[PHY_MEM / PGSIZE]; // users of each kalloc'ed page
 
 void init_page() {
   extern char end;
@@ -54,7 +55,7 @@ void init_page() {
   kpt[0].pte[0].val = 0;
   heap_ptr = (void *)KER_MEM;
   set_cr3(&kpd);
-  set_cr0(get_cr0() | CR0_PG);
+  set_cr0(get_cr0() | CR0_PG | CR0_WP); // kernel writes to read-only user pages fault too, see mmap_fault
   // Lab1-4: init free memory at [KER_MEM, PHY_MEM), a heap for kernel
   
 }
@@ -65,6 +66,7 @@ void *kalloc() {
   if((uint32_t)heap_ptr + PGSIZE >= PHY_MEM) assert(0);
   void *re_ptr = heap_ptr;
   memset(re_ptr, 0, PGSIZE);//Set the page to zero!
+  pgref[(size_t)re_ptr / PGSIZE] = 1;
 //  printf("kalloc at :%08x \n", (uint32_t)(re_ptr));
   heap_ptr = (void *)PAGE_DOWN((uint32_t)heap_ptr + PGSIZE);
   assert((uint32_t)re_ptr % PGSIZE == 0);//Check that the re_ptr is aliged!
@@ -76,6 +78,17 @@ void kfree(void *ptr) {
   // you can just do nothing :)
   //TODO();
   //Insert the new free page to the free_page_list
+  size_t i = (size_t)ptr / PGSIZE;
+  if (pgref[i] && --pgref[i]) return; // a fork still maps it elsewhere
+}
+
+void kdup(void *page) {
+  // one more memory maps page
+  pgref[(size_t)page / PGSIZE]++;
+}
+
+int kusers(void *page) {
+  return pgref[(size_t)page / PGSIZE];
 }
 
 PD *vm_alloc() {//OK
@@ -184,8 +197,9 @@ void vm_copycurr(PD *pgdir) {
   PD *curr_pgdir = vm_curr();
   for (size_t pgaddr = PAGE_DOWN(PHY_MEM) ; pgaddr < PAGE_DOWN(USR_MEM) ; pgaddr += PGSIZE)
   {
+    if (pgaddr == MMAP_BASE) pgaddr = MMAP_TOP; // mmap_dup sets the mappings up
     PTE *pte = vm_walkpte(curr_pgdir, pgaddr, 7);
-    if((pte != NULL) && (pte->present != 0))
+    if((pte != NULL) && (pte->present != 0) && !mmap_covers(proc_curr(), pgaddr))
       {
         size_t prot = (pte->user_supervisor) << 2 | (pte->read_write << 1) | (pte->present);
         assert(prot <= 7);//Make Sure The Prot is Valid!
@@ -197,6 +211,7 @@ void vm_copycurr(PD *pgdir) {
 }
 
 void vm_pgfault(size_t va, int errcode) {
+  if (mmap_fault(va, errcode)) return;
   printf("pagefault @ 0x%p, errcode = %d\n", va, errcode);
   panic("pgfault");
 }
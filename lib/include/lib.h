@@ -88,6 +88,18 @@ char *strtok(char *__restrict s, const char *__restrict delim);
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
 #define O_DIR     0x800
+#define O_DIRECT  0x1000 // whole aligned blocks skip the buffer cache
+
+// mmap prot and flags
+#define PROT_NONE  0x0
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4
+
+#define MAP_SHARED    0x01 // stores go back to the file
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20 // zeroed memory, no file
+#define MAP_FAILED    ((void *)-1)
 
 // seek whence
 #define SEEK_SET 0
@@ -99,6 +111,77 @@ struct stat {
   uint32_t type;
   uint32_t size;
   uint32_t node;
+  uint32_t blocks;  // disk blocks mapped
+  uint32_t extents; // runs of consecutive disk blocks they form, stat leaves
+                    // it 0 for a file mapped by block, fextents walks it
+  uint32_t mtime;   // last data change, seconds since the epoch
+  uint32_t ctime;   // last inode change
+};
+
+// a piece of a readv or writev
+struct iovec {
+  void *iov_base;
+  uint32_t iov_len;
+};
+
+#define IOV_MAX 16 // most pieces one call takes
+
+// dirfd of fstatat for a path relative to the cwd
+#define AT_FDCWD -100
+
+// directory entry from getdents, with what fstat would say about it
+struct dirstat {
+  uint32_t node;
+  uint32_t type;
+  uint32_t size;
+  char name[28]; // MAX_NAME + 1
+};
+
+// Submission and completion rings, shared by a proc and the kernel. The
+// user fills sq entries and moves sq_tail on, io_enter hands them in. They
+// run one after another in that order while the proc goes on, and their
+// results come back in cq.
+#define IORING_ENTRIES 64 // in each queue
+
+#define IORING_OP_NOP   0
+#define IORING_OP_READ  1
+#define IORING_OP_WRITE 2
+#define IORING_OP_OPEN  3 // res is the fd
+#define IORING_OP_CLOSE 4
+#define IORING_OP_FSYNC 5
+
+#define IORING_OFF_CUR ((uint32_t)-1) // at the file offset, which moves on
+
+struct io_sqe {
+  uint32_t op;
+  int fd;
+  void *addr;    // buffer, or the path to open
+  uint32_t len;  // bytes, or the open mode
+  uint32_t off;
+  uint32_t data; // goes back in the cqe as it is
+};
+
+struct io_cqe {
+  uint32_t data;
+  int res;
+};
+
+struct io_ring {
+  volatile uint32_t sq_head, sq_tail; // the kernel moves head, the user tail
+  volatile uint32_t cq_head, cq_tail; // the user moves head, the kernel tail
+  struct io_sqe sq[IORING_ENTRIES];
+  struct io_cqe cq[IORING_ENTRIES];
+};
+
+// block device stat
+struct iostat {
+  char name[16];
+  uint32_t nblk;
+  uint32_t maxbatch;  // most requests queued for one unplug, the deepest the
+                      // elevator's queue got
+  uint32_t rios, wios;   // transfers issued to the driver
+  uint32_t rblks, wblks; // blocks transferred
+  uint32_t merges;       // requests folded into a neighbour's transfer in a batch
 };
 
 #endif
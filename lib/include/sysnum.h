@@ -38,6 +38,24 @@
 #define SYS_link      31
 #define SYS_symlink   32
 
-#define NR_SYS        33
+// extension
+#define SYS_iostat    33
+#define SYS_uptime    34
+#define SYS_getdents  35
+#define SYS_stat      36
+#define SYS_fstatat   37
+#define SYS_pread     38
+#define SYS_pwrite    39
+#define SYS_readv     40
+#define SYS_writev    41
+#define SYS_sendfile  42
+#define SYS_copy_file_range 43
+#define SYS_io_setup  44
+#define SYS_io_enter  45
+#define SYS_ftruncate 46
+#define SYS_fallocate 47
+#define SYS_fextents  48
+
+#define NR_SYS        49
 
 #endif
@@ -30,8 +30,8 @@ int unlink(const char *path);
 #define V sem_v
 
 // optional syscall
-void *mmap();
-void munmap(void *addr);
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, uint32_t off);
+int munmap(void *addr, size_t len);
 int clone(void (*entry)(void*), void *stack, void *arg);
 int kill(int pid);
 int cv_open();
@@ -43,6 +43,30 @@ int pipe(int fd[2]);
 int link(const char *oldpath, const char *newpath);
 int symlink(const char *oldpath, const char *newpath);
 
+// extension
+int iostat(int id, struct iostat *st);
+uint32_t uptime(); // timer ticks since boot
+int getdents(int fd, struct dirstat *buf, size_t size); // bytes filled, 0 at the end
+int stat(const char *path, struct stat *st);
+int fstatat(int dirfd, const char *path, struct stat *st); // dirfd may be AT_FDCWD
+int pread(int fd, void *buf, size_t count, uint32_t off);
+int pwrite(int fd, const void *buf, size_t count, uint32_t off);
+int readv(int fd, const struct iovec *iov, int cnt);
+int writev(int fd, const struct iovec *iov, int cnt);
+int sendfile(int out_fd, int in_fd, uint32_t *off, size_t len); // off may be NULL
+int copy_file_range(int in_fd, uint32_t *off_in, int out_fd, uint32_t *off_out, size_t len);
+int io_setup(struct io_ring *ring); // one ring per proc
+int io_enter(int min_complete); // sq entries handed in, then waits for min_complete cq entries
+int ftruncate(int fd, uint32_t len);
+int fallocate(int fd, uint32_t off, uint32_t len); // disk blocks for the range now, the size grows to cover it
+int fextents(int fd, struct stat *st); // as fstat, but extents are counted for any file, at a walk of it
+
+// io ring helpers, an sqe goes to the next io_enter once filled and ready
+struct io_sqe *io_get_sqe(struct io_ring *ring); // NULL if sq is full
+void io_sqe_ready(struct io_ring *ring);
+struct io_cqe *io_peek_cqe(struct io_ring *ring); // NULL if cq is empty
+void io_cqe_seen(struct io_ring *ring);
+
 // stdio
 void putstr(const char *str);
 int printf(const char *format, ...);
@@ -1,19 +1,55 @@
 #include "ulib.h"
 
-char buf[4096];
+char buf[4 * 4096];
+struct iovec iov[IOV_MAX];
+int niov, used;
+
+// what the files gave so far goes out in one writev
+void
+flush(void)
+{
+  int i, n = 0;
+
+  for(i = 0; i < niov; i++)
+    n += iov[i].iov_len;
+  if(niov > 0 && writev(1, iov, niov) != n){
+    fprintf(2, "cat: write error\n");
+    exit(1);
+  }
+  niov = used = 0;
+}
 
 void
 cat(int fd)
 {
-  int n;
+  int n, tty;
+  struct stat st;
 
-  while((n = read(fd, buf, sizeof(buf))) > 0) {
-    if (write(1, buf, n) != n) {
-      fprintf(2, "cat: write error\n");
-      exit(1);
-    }
+  if(fstat(fd, &st) < 0)
+    st.type = TYPE_NONE;
+  if(st.type == TYPE_FILE && st.size > sizeof(buf) - used){
+    // too big to gather, the kernel copies it without passing through here
+    flush();
+    while((n = sendfile(1, fd, 0, 64 * 1024)) > 0)
+      ;
+    if(n == 0)
+      return;
+  }
+  tty = st.type == TYPE_DEV;
+  for(;;){
+    if(used == sizeof(buf) || niov == IOV_MAX)
+      flush();
+    if((n = read(fd, buf + used, sizeof(buf) - used)) <= 0)
+      break;
+    iov[niov].iov_base = buf + used;
+    iov[niov].iov_len = n;
+    niov++;
+    used += n;
+    if(tty)
+      flush();  // echo a terminal line by line
   }
   if(n < 0){
+    flush();
     fprintf(2, "cat: read error\n");
     exit(1);
   }
@@ -26,16 +62,19 @@ main(int argc, char *argv[])
 
   if(argc <= 1){
     cat(0);
+    flush();
     exit(0);
   }
 
   for(i = 1; i < argc; i++){
     if((fd = open(argv[i], 0)) < 0){
+      flush();  // what the earlier files gave still goes out
       fprintf(2, "cat: cannot open %s\n", argv[i]);
       exit(1);
     }
     cat(fd);
     close(fd);
   }
+  flush();
   exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include "ulib.h"
+
+// copy throughput through user space and in the kernel, usage: cpbench [KiB]
+
+#define HZ    100 // kernel timer frequency
+#define CHUNK (64 * 1024)
+
+char buf[CHUNK];
+
+void report(const char *what, int kib, uint32_t ticks) {
+  if (ticks == 0) ticks = 1;
+  printf("%s %d KiB in %d ticks, %d KiB/s\n", what, kib, ticks, kib * HZ / ticks);
+}
+
+// copies src to dst with read and write of size bytes, or in the kernel
+// with sendfile or copy_file_range when size is 0 or -1
+void copy(const char *what, int size, int kib) {
+  int in = open("cpbench.src", O_RDONLY);
+  int out = open("cpbench.dst", O_CREATE | O_WRONLY | O_TRUNC);
+  assert(in >= 0 && out >= 0);
+  uint32_t t0 = uptime();
+  int n, total = 0;
+  if (size > 0) {
+    while ((n = read(in, buf, size)) > 0) {
+      assert(write(out, buf, n) == n);
+      total += n;
+    }
+  } else if (size == 0) {
+    while ((n = sendfile(out, in, NULL, CHUNK)) > 0) total += n;
+  } else {
+    while ((n = copy_file_range(in, NULL, out, NULL, CHUNK)) > 0) total += n;
+  }
+  close(out); // close writes the dirty blocks back
+  report(what, total / 1024, uptime() - t0);
+  assert(total == kib * 1024);
+  close(in);
+}
+
+int main(int argc, char *argv[]) {
+  int kib = argc > 1 ? atoi(argv[1]) : 2048;
+  for (int i = 0; i < CHUNK; ++i) buf[i] = i;
+  int fd = open("cpbench.src", O_CREATE | O_WRONLY | O_TRUNC);
+  assert(fd >= 0);
+  for (int i = 0; i < kib * 1024 / CHUNK; ++i) {
+    assert(write(fd, buf, CHUNK) == CHUNK);
+  }
+  close(fd);
+  kib = kib * 1024 / CHUNK * CHUNK / 1024;
+
+  copy("read/write 512B", 512, kib);
+  copy("read/write 64KiB", CHUNK, kib);
+  copy("sendfile", 0, kib);
+  copy("copy_file_range", -1, kib);
+
+  unlink("cpbench.src");
+  unlink("cpbench.dst");
+  return 0;
+}
@@ -0,0 +1,61 @@
+#include "ulib.h"
+
+// frag [dir...]: extents of each file and their average length in blocks
+
+uint32_t nfile, nblk, next;
+
+void frag(char *path) {
+  char buf[512], *p;
+  int fd;
+  struct dirent de;
+  struct stat st;
+  int f;
+
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    fprintf(2, "frag: cannot open %s\n", path);
+    if (fd >= 0) close(fd);
+    return;
+  }
+  if (st.type != TYPE_DIR) {
+    close(fd);
+    return;
+  }
+  if (strlen(path) + 1 + MAX_NAME + 1 > sizeof buf) {
+    printf("frag: path too long\n");
+    close(fd);
+    return;
+  }
+  strcpy(buf, path);
+  p = buf + strlen(buf);
+  *p++ = '/';
+  while (read(fd, &de, sizeof(de)) == sizeof(de)) {
+    if (de.node == 0) continue;
+    memcpy(p, de.name, MAX_NAME);
+    p[MAX_NAME] = 0;
+    // stat leaves the extents of an addrs-mapped file uncounted
+    if (fstatat(fd, p, &st) < 0 || st.type != TYPE_FILE || (f = open(buf, O_RDONLY)) < 0) continue;
+    if (fextents(f, &st) == 0 && st.extents) {
+      printf("%-32s %6d blocks %4d extents %5d.%d avg\n", buf, st.blocks, st.extents,
+             st.blocks / st.extents, st.blocks * 10 / st.extents % 10);
+      nfile++;
+      nblk += st.blocks;
+      next += st.extents;
+    }
+    close(f);
+  }
+  close(fd);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    frag(".");
+  }
+  for (int i = 1; i < argc; i++) {
+    frag(argv[i]);
+  }
+  if (next) {
+    printf("%d files, %d blocks in %d extents, %d.%d blocks per extent\n", nfile, nblk, next,
+           nblk / next, nblk * 10 / next % 10);
+  }
+  return 0;
+}
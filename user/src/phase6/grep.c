@@ -31,11 +31,28 @@ grep(char *pattern, int fd)
   }
 }
 
+// scans a mapped file in place, the matcher stops at a line's \n so the
+// pages are only read and shared with the page cache; a last line without
+// \n is left out as grep() does
+void
+grepmap(char *pattern, char *p, int n)
+{
+  char *q, *end;
+
+  end = p + n;
+  while((q = memchr(p, '\n', end - p)) != 0){
+    if(match(pattern, p))
+      write(1, p, q+1 - p);
+    p = q+1;
+  }
+}
+
 int
 main(int argc, char *argv[])
 {
   int fd, i;
-  char *pattern;
+  char *pattern, *p;
+  struct stat st;
 
   if(argc <= 1){
     fprintf(2, "usage: grep pattern [file ...]\n");
@@ -53,7 +70,14 @@ main(int argc, char *argv[])
       printf("grep: cannot open %s\n", argv[i]);
       exit(1);
     }
-    grep(pattern, fd);
+    p = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && st.type == TYPE_FILE && st.size > 0)
+      p = mmap(0, st.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p != MAP_FAILED){
+      grepmap(pattern, p, st.size);
+      munmap(p, st.size);
+    } else
+      grep(pattern, fd);
     close(fd);
   }
   exit(0);
@@ -62,6 +86,8 @@ main(int argc, char *argv[])
 // Regexp matcher from Kernighan & Pike,
 // The Practice of Programming, Chapter 9.
 
+#define EOL(c) ((c) == '\0' || (c) == '\n') // the end of the text
+
 int matchhere(char*, char*);
 int matchstar(int, char*, char*);
 
@@ -73,7 +99,7 @@ match(char *re, char *text)
   do{  // must look at empty string
     if(matchhere(re, text))
       return 1;
-  }while(*text++ != '\0');
+  }while(!EOL(*text++));
   return 0;
 }
 
@@ -85,8 +111,8 @@ int matchhere(char *re, char *text)
   if(re[1] == '*')
     return matchstar(re[0], re+2, text);
   if(re[0] == '$' && re[1] == '\0')
-    return *text == '\0';
-  if(*text!='\0' && (re[0]=='.' || re[0]==*text))
+    return EOL(*text);
+  if(!EOL(*text) && (re[0]=='.' || re[0]==*text))
     return matchhere(re+1, text+1);
   return 0;
 }
@@ -97,7 +123,7 @@ int matchstar(int c, char *re, char *text)
   do{  // a * matches zero or more instances
     if(matchhere(re, text))
       return 1;
-  }while(*text!='\0' && (*text++==c || c=='.'));
+  }while(!EOL(*text) && (*text++==c || c=='.'));
   return 0;
 }
 
@@ -0,0 +1,47 @@
+#include "ulib.h"
+
+// sequential write then read of a file, usage: iobench [-d] [file] [KiB]
+// where -d opens it O_DIRECT
+
+#define HZ    100 // kernel timer frequency
+#define CHUNK (64 * 1024)
+
+char buf[CHUNK] __attribute__((aligned(4096))); // O_DIRECT moves whole pages
+
+void report(const char *what, int kib, uint32_t ticks) {
+  if (ticks == 0) ticks = 1;
+  printf("%s %d KiB in %d ticks, %d KiB/s\n", what, kib, ticks, kib * HZ / ticks);
+}
+
+int main(int argc, char *argv[]) {
+  int direct = argc > 1 && strcmp(argv[1], "-d") == 0 ? O_DIRECT : 0;
+  if (direct) {
+    argc--;
+    argv++;
+  }
+  char *path = argc > 1 ? argv[1] : "iobench.tmp";
+  int kib = argc > 2 ? atoi(argv[2]) : 2048;
+  int n = kib * 1024 / CHUNK;
+  for (int i = 0; i < CHUNK; ++i) buf[i] = i;
+
+  int fd = open(path, O_CREATE | O_WRONLY | O_TRUNC | direct);
+  assert(fd >= 0);
+  uint32_t t0 = uptime();
+  for (int i = 0; i < n; ++i) {
+    assert(write(fd, buf, CHUNK) == CHUNK);
+  }
+  close(fd); // close writes the dirty blocks back
+  report("write", n * CHUNK / 1024, uptime() - t0);
+
+  fd = open(path, O_RDONLY | direct);
+  assert(fd >= 0);
+  t0 = uptime();
+  for (int i = 0; i < n; ++i) {
+    assert(read(fd, buf, CHUNK) == CHUNK);
+  }
+  close(fd);
+  report("read", n * CHUNK / 1024, uptime() - t0);
+
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,11 @@
+#include "ulib.h"
+
+int main() {
+  struct iostat st;
+  printf("dev      maxq  rios  rblks  wios  wblks  merges\n");
+  for (int i = 0; iostat(i, &st) == 0; ++i) {
+    printf("%-8s %4d %5d %6d %5d %6d %7d\n", st.name, st.maxbatch,
+           st.rios, st.rblks, st.wios, st.wblks, st.merges);
+  }
+  return 0;
+}
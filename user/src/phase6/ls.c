@@ -19,26 +19,11 @@ fmtname(char *path)
   return buf;
 }
 
-int
-stat(const char *n, struct stat *st)
-{
-  int fd;
-  int r;
-
-  fd = open(n, O_RDONLY);
-  if(fd < 0)
-    return -1;
-  r = fstat(fd, st);
-  close(fd);
-  return r;
-}
-
 void
 ls(char *path)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, n, i;
+  struct dirstat ents[16];
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -59,23 +44,10 @@ ls(char *path)
     break;
 
   case TYPE_DIR:
-    if(strlen(path) + 1 + MAX_NAME + 1 > sizeof buf){
-      printf("ls: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.node == 0)
-        continue;
-      memcpy(p, de.name, MAX_NAME);
-      p[MAX_NAME] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
-      }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.size, st.node);
+    // a batch of entries per call, each with its type and size
+    while((n = getdents(fd, ents, sizeof ents)) > 0){
+      for(i = 0; i < n / sizeof(ents[0]); i++)
+        printf("%s %d %d %d\n", fmtname(ents[i].name), ents[i].type, ents[i].size, ents[i].node);
     }
     break;
   }
@@ -0,0 +1,89 @@
+#include "ulib.h"
+
+// a file is mapped, then truncated, and its blocks go to a second file;
+// neither the mapping nor the second file may see the other's data. Then
+// a fork: shared mappings stay shared, private ones are copied on write
+
+#define NPAGE 16
+#define SIZE  (NPAGE * 4096)
+
+char buf[4096];
+
+void fill(const char *path, char c) {
+  int fd = open(path, O_WRONLY | O_TRUNC | O_CREATE);
+  assert(fd >= 0);
+  memset(buf, c, sizeof buf);
+  for (int i = 0; i < NPAGE; ++i) {
+    assert(write(fd, buf, sizeof buf) == sizeof buf);
+  }
+  close(fd);
+}
+
+void forktest() {
+  fill("mapa", 'a');
+  int fd = open("mapa", O_RDWR);
+  assert(fd >= 0);
+  char *f = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  char *s = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  char *q = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  char *r = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  assert(f != (char *)-1 && s != (char *)-1 && q != (char *)-1 && r != (char *)-1);
+  assert(f[0] == 'a' && r[0] == 'a');
+  s[0] = 's';
+  q[0] = 'q';
+  int pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    assert(s[0] == 's' && q[0] == 'q' && r[0] == 'a');
+    f[0] = 'c';
+    s[0] = 'c';
+    q[0] = 'c';
+    r[0] = 'c';
+    exit(0); // the child's copy of f's page must not undo the parent's store
+  }
+  f[1] = 'p';
+  assert(wait(NULL) == pid);
+  assert(f[0] == 'c' && f[1] == 'p' && s[0] == 'c');
+  assert(q[0] == 'q' && r[0] == 'a');
+  assert(munmap(f, SIZE) == 0 && munmap(s, 4096) == 0);
+  assert(munmap(q, 4096) == 0 && munmap(r, SIZE) == 0);
+  assert(read(fd, buf, 2) == 2 && buf[0] == 'c' && buf[1] == 'p');
+  close(fd);
+  unlink("mapa");
+}
+
+int main() {
+  printf("maptest start\n");
+  unlink("mapb");
+  fill("mapa", 'a');
+  int fd = open("mapa", O_RDWR);
+  assert(fd >= 0);
+  char *p = mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(p != (char *)-1);
+  for (int i = 0; i < SIZE; i += 4096) assert(p[i] == 'a');
+
+  // the freed blocks are the first free run this size, so mapb takes them
+  assert(ftruncate(fd, 0) == 0);
+  int fb = open("mapb", O_RDWR | O_CREATE);
+  assert(fb >= 0 && fallocate(fb, 0, SIZE) == 0);
+  close(fb);
+  fill("mapb", 'b');
+
+  for (int i = 0; i < SIZE; ++i) assert(p[i] == 'a');
+  memset(p, 'x', SIZE);
+  assert(munmap(p, SIZE) == 0);
+  close(fd);
+
+  fb = open("mapb", O_RDONLY);
+  assert(fb >= 0);
+  for (int i = 0; i < NPAGE; ++i) {
+    assert(read(fb, buf, sizeof buf) == sizeof buf);
+    for (int j = 0; j < sizeof buf; ++j) assert(buf[j] == 'b');
+  }
+  close(fb);
+  unlink("mapa");
+  unlink("mapb");
+  forktest();
+  printf("maptest passed\n");
+  return 0;
+}
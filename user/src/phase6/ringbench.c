@@ -0,0 +1,111 @@
+#include "ulib.h"
+
+// writes a file through the io ring, then reads it back with read and with
+// the ring while summing each chunk, usage: ringbench [KiB]
+
+#define HZ    100 // kernel timer frequency
+#define CHUNK (16 * 1024)
+#define DEPTH 16 // reads in flight
+
+char buf[DEPTH][CHUNK];
+struct io_ring ring;
+int queued; // entries whose result is not reaped yet
+
+void report(const char *what, int kib, uint32_t ticks) {
+  if (ticks == 0) ticks = 1;
+  printf("%s %d KiB in %d ticks, %d KiB/s\n", what, kib, ticks, kib * HZ / ticks);
+}
+
+uint32_t sum(const char *p) {
+  // a few rounds over the chunk, the compute a read can hide behind
+  uint32_t s = 0;
+  for (int r = 0; r < 4; ++r) {
+    for (int i = 0; i < CHUNK; ++i) s = s * 31 + p[i];
+  }
+  return s;
+}
+
+struct io_cqe reap() {
+  struct io_cqe *cqe, c;
+  while ((cqe = io_peek_cqe(&ring)) == NULL) assert(io_enter(1) >= 0);
+  c = *cqe;
+  io_cqe_seen(&ring);
+  queued--;
+  return c;
+}
+
+void submit(uint32_t op, int fd, void *addr, uint32_t len, uint32_t off, uint32_t data) {
+  struct io_sqe *sqe;
+  while ((sqe = io_get_sqe(&ring)) == NULL) {
+    // sq is full, what is in it goes in as results are reaped
+    struct io_cqe c = reap();
+    assert(c.res >= 0);
+  }
+  sqe->op = op;
+  sqe->fd = fd;
+  sqe->addr = addr;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->data = data;
+  io_sqe_ready(&ring);
+  queued++;
+}
+
+int main(int argc, char *argv[]) {
+  int kib = argc > 1 ? atoi(argv[1]) : 2048;
+  int n = kib * 1024 / CHUNK;
+  assert(io_setup(&ring) == 0);
+  for (int i = 0; i < CHUNK; ++i) buf[0][i] = i * 7;
+
+  // open, all the writes, fsync and close, a handful of traps in all
+  uint32_t t0 = uptime();
+  submit(IORING_OP_OPEN, 0, "ringbench.tmp", O_CREATE | O_WRONLY | O_TRUNC, 0, 0);
+  int fd = reap().res;
+  assert(fd >= 0);
+  for (int i = 0; i < n; ++i) {
+    submit(IORING_OP_WRITE, fd, buf[0], CHUNK, i * CHUNK, i);
+  }
+  submit(IORING_OP_FSYNC, fd, NULL, 0, 0, n);
+  submit(IORING_OP_CLOSE, fd, NULL, 0, 0, n + 1);
+  while (queued) {
+    struct io_cqe c = reap();
+    assert(c.res == (c.data < n ? CHUNK : 0));
+  }
+  report("ring write", n * CHUNK / 1024, uptime() - t0);
+
+  uint32_t total = 0;
+  fd = open("ringbench.tmp", O_RDONLY);
+  assert(fd >= 0);
+  t0 = uptime();
+  for (int i = 0; i < n; ++i) {
+    assert(read(fd, buf[0], CHUNK) == CHUNK);
+    total += sum(buf[0]);
+  }
+  close(fd);
+  report("read+sum", n * CHUNK / 1024, uptime() - t0);
+
+  // DEPTH reads ahead of the sum, each buffer read again once summed
+  uint32_t rtotal = 0;
+  fd = open("ringbench.tmp", O_RDONLY);
+  assert(fd >= 0);
+  t0 = uptime();
+  for (int i = 0; i < DEPTH && i < n; ++i) {
+    submit(IORING_OP_READ, fd, buf[i], CHUNK, i * CHUNK, i);
+  }
+  assert(io_enter(0) >= 0);
+  for (int done = 0; done < n; ++done) {
+    struct io_cqe c = reap();
+    assert(c.res == CHUNK);
+    rtotal += sum(buf[c.data % DEPTH]);
+    if (c.data + DEPTH < n) {
+      submit(IORING_OP_READ, fd, buf[c.data % DEPTH], CHUNK, (c.data + DEPTH) * CHUNK, c.data + DEPTH);
+      assert(io_enter(0) >= 0);
+    }
+  }
+  close(fd);
+  report("ring read+sum", n * CHUNK / 1024, uptime() - t0);
+  assert(rtotal == total);
+
+  unlink("ringbench.tmp");
+  return 0;
+}
@@ -84,7 +84,8 @@ runcmd(struct cmd *cmd)
       fprintf(2, "open %s failed\n", rcmd->file);
       exit(1);
     }
-    lseek(rcmd->fd, 0, rcmd->whence);
+    if(rcmd->whence != SEEK_SET)  // open already starts at 0
+      lseek(rcmd->fd, 0, rcmd->whence);
     runcmd(rcmd->cmd);
     break;
 
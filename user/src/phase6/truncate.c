@@ -0,0 +1,29 @@
+#include "ulib.h"
+
+// truncate [-a] bytes file...: sets the size of each file, made if missing;
+// with -a the blocks up to it are allocated too, in as few extents as can be
+
+int main(int argc, char *argv[]) {
+  int alloc = argc > 1 && strcmp(argv[1], "-a") == 0;
+  if (alloc) {
+    argc--;
+    argv++;
+  }
+  if (argc < 3) {
+    fprintf(2, "usage: truncate [-a] bytes file...\n");
+    exit(1);
+  }
+  uint32_t len = atoi(argv[1]);
+  for (int i = 2; i < argc; i++) {
+    int fd = open(argv[i], O_CREATE | O_WRONLY);
+    if (fd < 0) {
+      fprintf(2, "truncate: cannot open %s\n", argv[i]);
+      continue;
+    }
+    if (ftruncate(fd, len) < 0 || (alloc && len && fallocate(fd, 0, len) < 0)) {
+      fprintf(2, "truncate: %s failed\n", argv[i]);
+    }
+    close(fd);
+  }
+  return 0;
+}
@@ -99,3 +99,23 @@ malloc(size_t nbytes)
   }
 }
 
+
+struct io_sqe *io_get_sqe(struct io_ring *ring) {
+  if (ring->sq_tail - ring->sq_head == IORING_ENTRIES) return NULL;
+  struct io_sqe *sqe = &ring->sq[ring->sq_tail % IORING_ENTRIES];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+void io_sqe_ready(struct io_ring *ring) {
+  ring->sq_tail++;
+}
+
+struct io_cqe *io_peek_cqe(struct io_ring *ring) {
+  if (ring->cq_head == ring->cq_tail) return NULL;
+  return &ring->cq[ring->cq_head % IORING_ENTRIES];
+}
+
+void io_cqe_seen(struct io_ring *ring) {
+  ring->cq_head++;
+}
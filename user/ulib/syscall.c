@@ -99,12 +99,13 @@ int unlink(const char *path) {
 
 // optional syscall
 
-void *mmap() {
-  return (void*)syscall(SYS_mmap, 0, 0, 0, 0, 0);
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, uint32_t off) {
+  size_t args[6] = {(size_t)addr, len, (size_t)prot, (size_t)flags, (size_t)fd, (size_t)off};
+  return (void*)syscall(SYS_mmap, (size_t)args, 0, 0, 0, 0);
 }
 
-void munmap(void *addr) {
-  syscall(SYS_munmap, (size_t)addr, 0, 0, 0, 0);
+int munmap(void *addr, size_t len) {
+  return (int)syscall(SYS_munmap, (size_t)addr, len, 0, 0, 0);
 }
 
 int clone(void (*entry)(void*), void *stack, void *arg) {
@@ -146,3 +147,67 @@ int link(const char *oldpath, const char *newpath) {
 int symlink(const char *oldpath, const char *newpath) {
   return (int)syscall(SYS_symlink, (size_t)oldpath, (size_t)newpath, 0, 0, 0);
 }
+
+int iostat(int id, struct iostat *st) {
+  return (int)syscall(SYS_iostat, (size_t)id, (size_t)st, 0, 0, 0);
+}
+
+uint32_t uptime() {
+  return (uint32_t)syscall(SYS_uptime, 0, 0, 0, 0, 0);
+}
+
+int getdents(int fd, struct dirstat *buf, size_t size) {
+  return (int)syscall(SYS_getdents, (size_t)fd, (size_t)buf, (size_t)size, 0, 0);
+}
+
+int stat(const char *path, struct stat *st) {
+  return (int)syscall(SYS_stat, (size_t)path, (size_t)st, 0, 0, 0);
+}
+
+int fstatat(int dirfd, const char *path, struct stat *st) {
+  return (int)syscall(SYS_fstatat, (size_t)dirfd, (size_t)path, (size_t)st, 0, 0);
+}
+
+int pread(int fd, void *buf, size_t count, uint32_t off) {
+  return (int)syscall(SYS_pread, (size_t)fd, (size_t)buf, count, (size_t)off, 0);
+}
+
+int pwrite(int fd, const void *buf, size_t count, uint32_t off) {
+  return (int)syscall(SYS_pwrite, (size_t)fd, (size_t)buf, count, (size_t)off, 0);
+}
+
+int readv(int fd, const struct iovec *iov, int cnt) {
+  return (int)syscall(SYS_readv, (size_t)fd, (size_t)iov, (size_t)cnt, 0, 0);
+}
+
+int writev(int fd, const struct iovec *iov, int cnt) {
+  return (int)syscall(SYS_writev, (size_t)fd, (size_t)iov, (size_t)cnt, 0, 0);
+}
+
+int sendfile(int out_fd, int in_fd, uint32_t *off, size_t len) {
+  return (int)syscall(SYS_sendfile, (size_t)out_fd, (size_t)in_fd, (size_t)off, len, 0);
+}
+
+int copy_file_range(int in_fd, uint32_t *off_in, int out_fd, uint32_t *off_out, size_t len) {
+  return (int)syscall(SYS_copy_file_range, (size_t)in_fd, (size_t)off_in, (size_t)out_fd, (size_t)off_out, len);
+}
+
+int io_setup(struct io_ring *ring) {
+  return (int)syscall(SYS_io_setup, (size_t)ring, 0, 0, 0, 0);
+}
+
+int io_enter(int min_complete) {
+  return (int)syscall(SYS_io_enter, (size_t)min_complete, 0, 0, 0, 0);
+}
+
+int ftruncate(int fd, uint32_t len) {
+  return (int)syscall(SYS_ftruncate, (size_t)fd, len, 0, 0, 0);
+}
+
+int fallocate(int fd, uint32_t off, uint32_t len) {
+  return (int)syscall(SYS_fallocate, (size_t)fd, off, len, 0, 0);
+}
+
+int fextents(int fd, struct stat *st) {
+  return (int)syscall(SYS_fextents, (size_t)fd, (size_t)st, 0, 0, 0);
+}
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 __attribute__((noreturn))
 void panic(const char *msg) {
@@ -20,10 +21,10 @@ void panic(const char *msg) {
 #define TODO() panic("implement me")
 
 // Disk layout:
-//         [ boot.img | kernel.img |                      user.img                      ]
-//         [   mbr    |   kernel   | super block | bit map | inode blocks | data blocks ]
-// sect    0          1          256           264       272            512        262144
-// block   0                      32            33        34             64         32768
+//         [ boot.img | kernel.img |                         user.img                          ]
+//         [   mbr    |   kernel   | super block | bit map | inode blocks |   log   | data blocks ]
+// sect    0          1          256           264       272            512       1536      262144
+// block   0                      32            33        34             64        192       32768
 // YOUR TASK: build user.img
 
 #define DISK_SIZE (128 * 1024 * 1024) // disk is 128 MiB
@@ -37,12 +38,16 @@ void panic(const char *msg) {
 #define BITMAP_BLK  (BLK_OFF + 1)  // block no of bitmap
 #define INODE_START (BLK_OFF + 2)  // start block no of inode blocks
 #define DATA_START  (BLK_OFF + 32) // start block no of data blocks
+#define LOG_START   DATA_START     // redo log header, its blocks follow
+#define LOG_BLKS    128            // log size, marked used in the bitmap
 
 #define IPERBLK   (BLK_SIZE / sizeof(dinode_t)) // inode num per blk
 #define INODE_NUM ((DATA_START - INODE_START) * IPERBLK)
 
 #define NDIRECT   12
 #define NINDIRECT (BLK_SIZE / sizeof(uint32_t))
+#define NEXTENT   6
+#define INLINE_MAX (NEXTENT * 3 * sizeof(uint32_t)) // bytes a file keeps in its inode
 
 #define TYPE_NONE 0
 #define TYPE_FILE 1
@@ -64,16 +69,42 @@ typedef struct {
   uint32_t istart; // start block no of inode blocks
   uint32_t inum;   // total inode num
   uint32_t root;   // inode no of root dir
+  uint32_t nblk;   // blocks covered by the bitmap
+  uint32_t magic;
+  uint32_t nfree;  // free blocks
+  uint32_t ifree;  // free inodes
+  uint32_t logstart; // block no of the redo log header
+  uint32_t nlog;     // blocks of the log, 0 if there is none
 } sb_t;
 
+#define FS_MAGIC 0x4f534c63
+
 // on-disk inode
 typedef struct {
   uint32_t type;   // file type
-  uint32_t device; // if it is a dev, its dev_id
+  union {
+    uint32_t device; // if it is a dev, its dev_id
+    uint32_t dindex; // if it is a dir, block no of its hash index or 0
+  };
   uint32_t size;   // file size
-  uint32_t addrs[NDIRECT + 1]; // data block addresses, 12 direct and 1 indirect
+  uint32_t flags;
+  union {
+    uint32_t addrs[NDIRECT + 2]; // 12 direct, 1 indirect and 1 double indirect
+    struct extent {
+      uint32_t lblk;  // first block in the file
+      uint32_t start; // first block on disk
+      uint32_t len;   // 0 if the slot is unused
+    } ext[NEXTENT];   // sorted by lblk
+    uint8_t idata[INLINE_MAX];
+  };
+  uint32_t mtime;  // last data change, seconds since the epoch
+  uint32_t ctime;  // last inode change
+  uint32_t reserved[8]; // pads the inode to 128 bytes
 } dinode_t;
 
+#define DI_EXTENT 0x1 // blocks are mapped by ext[], else by addrs[]
+#define DI_INLINE 0x2 // no blocks, the bytes are in idata[]
+
 // directory is a file containing a sequence of dirent structures
 
 #define MAX_NAME  (31 - sizeof(uint32_t))
@@ -82,6 +113,14 @@ typedef struct {
   char name[MAX_NAME + 1]; // name of the file
 } dirent_t;
 
+// dir hash index, kept in sync with the kernel: the top block holds the
+// live dirent count and IDX_NBUCKET bucket block nos, a bucket block holds
+// a pair count, the next block of the bucket and (name hash, dirent
+// offset) pairs
+#define DIR_INDEX_MIN 64
+#define IDX_NBUCKET   64
+#define IDX_NPAIR     (BLK_SIZE / 8 - 1)
+
 struct {blk_t blocks[IMG_BLK];} *img; // pointor to the img mapped memory
 sb_t *sb; // pointor to the super block
 blk_t *bitmap; // pointor to the bitmap block
@@ -102,27 +141,58 @@ static inline dinode_t *iget(uint32_t no) {
 void init_disk();
 uint32_t balloc();
 uint32_t ialloc(int type);
+uint32_t *iaddr(dinode_t *file, uint32_t blk_no);
+void iext_convert(dinode_t *file);
 blk_t *iwalk(dinode_t *file, uint32_t blk_no);
 void iappend(dinode_t *file, const void *buf, uint32_t size);
+void iunline(dinode_t *file);
 void add_file(char *path);
+void count_free();
+void index_dir(dinode_t *dir);
+void stripe(const char *target, int n);
 
 int main(int argc, char *argv[]) {
   // argv[1] is target user.img, argv[2..argc-1] are files you need to add
+  // options come first: -r n also stripes the fs over n RAID-0 member
+  // images, -i gives the root dir a hash index however small it is
+  int raid = 0, index = 0;
+  while (argc > 2 && argv[1][0] == '-') {
+    if (strcmp(argv[1], "-r") == 0) {
+      raid = atoi(argv[2]);
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-i") == 0) {
+      index = 1;
+    } else {
+      panic("unknown option");
+    }
+    argc--;
+    argv++;
+  }
   assert(argc > 2);
   static_assert(BLK_SIZE % sizeof(dinode_t) == 0, "sizeof inode should divide BLK_SIZE");
   char *target = argv[1];
-  int tfd = open(target, O_RDWR | O_CREAT | O_TRUNC, 0777);
-  if (tfd < 0) panic("open target error");
-  if (ftruncate(tfd, IMG_SIZE) < 0) panic("truncate error");
-  // map the img to memory, you can edit file by edit memory
-  img = mmap(NULL, IMG_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, tfd, 0);
+  int tfd = -1;
+  if (raid) {
+    // only the member images are written, the whole fs stays in memory
+    img = mmap(NULL, IMG_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  } else {
+    tfd = open(target, O_RDWR | O_CREAT | O_TRUNC, 0777);
+    if (tfd < 0) panic("open target error");
+    if (ftruncate(tfd, IMG_SIZE) < 0) panic("truncate error");
+    // map the img to memory, you can edit file by edit memory
+    img = mmap(NULL, IMG_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, tfd, 0);
+  }
   assert(img != (void*)-1);
   init_disk();
   for (int i = 2; i < argc; ++i) {
     add_file(argv[i]);
   }
+  if (index || root->size >= DIR_INDEX_MIN * sizeof(dirent_t)) index_dir(root);
+  count_free();
+  if (raid) stripe(target, raid);
   munmap(img, IMG_SIZE);
-  close(tfd);
+  if (tfd >= 0) close(tfd);
   return 0;
 }
 
@@ -131,9 +201,15 @@ void init_disk() {
   sb->bitmap = BITMAP_BLK;
   sb->istart = INODE_START;
   sb->inum = INODE_NUM;
+  sb->nblk = BLK_NUM;
+  sb->magic = FS_MAGIC;
+  sb->logstart = LOG_START;
+  sb->nlog = LOG_BLKS;
   bitmap = bget(BITMAP_BLK);
-  // mark first 64 blocks used
-  bitmap->u32buf[0] = bitmap->u32buf[1] = 0xffffffff;
+  // mark first 64 blocks and the log used, the log starts out empty
+  for (uint32_t i = 0; i < LOG_START + LOG_BLKS; ++i) {
+    bitmap->u8buf[i / 8] |= 1 << (i % 8);
+  }
   // alloc and init root inode
   sb->root = ialloc(TYPE_DIR);
   root = iget(sb->root);
@@ -146,9 +222,20 @@ void init_disk() {
   iappend(root, &dirent, sizeof dirent);
 }
 
+void count_free() {
+  // free counts in the super block, the kernel recounts them at mount
+  sb->nfree = sb->ifree = 0;
+  for (uint32_t i = 0; i < BLK_NUM; ++i) {
+    if (!(bitmap->u8buf[i / 8] & (1 << (i % 8)))) sb->nfree++;
+  }
+  for (uint32_t i = 1; i < INODE_NUM; ++i) {
+    if (iget(i)->type == TYPE_NONE) sb->ifree++;
+  }
+}
+
 uint32_t balloc() {
   // alloc a unused block, mark it on bitmap, then return its no
-  static uint32_t next_blk = 64;
+  static uint32_t next_blk = LOG_START + LOG_BLKS;
   if (next_blk >= BLK_NUM) panic("no more block");
   bitmap->u8buf[next_blk / 8] |= (1 << (next_blk % 8));
   return next_blk++;
@@ -160,57 +247,96 @@ uint32_t ialloc(int type) {
   static uint32_t next_inode = 1;
   if (next_inode >= INODE_NUM) panic("no more inode");
   iget(next_inode)->type = type;
+  iget(next_inode)->flags = DI_EXTENT | DI_INLINE;
+  iget(next_inode)->mtime = iget(next_inode)->ctime = time(NULL);
   return next_inode++;
 }
 
 //
+uint32_t *iaddr(dinode_t *file, uint32_t blk_no) {
+  // the addrs[] or indirect slot of the blk_no th block, the indirect
+  // blocks on the way are allocated
+  if (blk_no < NDIRECT) return &file->addrs[blk_no];
+  blk_no -= NDIRECT;
+  int level = blk_no < NINDIRECT ? 1 : 2;
+  if (level == 2) {
+    blk_no -= NINDIRECT;
+    if (blk_no >= NINDIRECT * NINDIRECT) panic("file too big");
+  }
+  uint32_t *slot = &file->addrs[NDIRECT + level - 1];
+  if (level == 2) {
+    if (*slot == 0) *slot = balloc();
+    slot = &bget(*slot)->u32buf[blk_no / NINDIRECT];
+  }
+  if (*slot == 0) *slot = balloc();
+  return &bget(*slot)->u32buf[blk_no % NINDIRECT];
+}
+
+void iext_convert(dinode_t *file) {
+  // out of extent slots: move the mapping to addrs[] for good, as the
+  // kernel does
+  struct extent ext[NEXTENT];
+  memcpy(ext, file->ext, sizeof ext);
+  memset(file->ext, 0, sizeof ext);
+  file->flags &= ~DI_EXTENT;
+  for (int i = 0; i < NEXTENT; ++i) {
+    for (uint32_t j = 0; j < ext[i].len; ++j) *iaddr(file, ext[i].lblk + j) = ext[i].start + j;
+  }
+}
+
 blk_t *iwalk(dinode_t *file, uint32_t blk_no) {
   // return the pointer to the file's data's blk_no th block, if no, alloc it
-  uint32_t no = 0;
-  if (blk_no < NDIRECT) {
-    // direct address!
-    // TODO();
-    no = file->addrs[blk_no];//First direct get the blk number
-    //If no is zero, which means hasn't distribute a blk!
-    if(no == 0) //Means the block number doesn't exists
-      {
-        no = balloc();
-        file->addrs[blk_no] = no;
-      }
-    if(no < 64) panic("The block number is over 64!");
-    return bget(no);//Return the memory address of no blk
+  // files are written in order, so a new block extends the last extent
+  // unless another file took the blocks after it
+  if (!(file->flags & DI_EXTENT)) {
+    uint32_t *slot = iaddr(file, blk_no);
+    if (*slot == 0) *slot = balloc();
+    return bget(*slot);
   }
-  blk_no -= NDIRECT;
-  if (blk_no < NINDIRECT) {
-    // indirect address
-    //The indirect block is in the file->addrs[NDIRECT] block!
-    //we should get the 1024 addr!
-    uint32_t ind_blk = file->addrs[NDIRECT];
-    if(ind_blk == 0)//Means there is no indirect block for
-      {
-        file->addrs[NDIRECT] = balloc();
-        ind_blk = file->addrs[NDIRECT];
-      }
-    if(ind_blk < 64) panic("The indirect block number is less than 64");
-    //Here we get the ind_blk is the place for indirect index
-    //Next we should find the blk_no in the place!
-    no = bget(ind_blk)->u32buf[blk_no];
-    //(img->blocks[ind_blk].u32buf[blk_no]);
-    if(no == 0)
-    {
-      no = balloc();
-      bget(ind_blk)->u32buf[blk_no] = no;
-    }
-    return bget(no);
+  int n = 0;
+  for (; n < NEXTENT && file->ext[n].len; ++n) {
+    struct extent *e = &file->ext[n];
+    if (blk_no >= e->lblk && blk_no < e->lblk + e->len) return bget(e->start + blk_no - e->lblk);
+  }
+  uint32_t no = balloc();
+  struct extent *last = n ? &file->ext[n - 1] : NULL;
+  if (last && blk_no == last->lblk + last->len && no == last->start + last->len) {
+    last->len++;
+  } else if (n == NEXTENT) {
+    iext_convert(file);
+    *iaddr(file, blk_no) = no;
+  } else {
+    file->ext[n].lblk = blk_no;
+    file->ext[n].start = no;
+    file->ext[n].len = 1;
   }
-  panic("file too big");
+  return bget(no);
 }
 
 //
+void iunline(dinode_t *file) {
+  // the file outgrew its inode, its bytes move to a block
+  uint8_t data[INLINE_MAX];
+  uint32_t size = file->size;
+  memcpy(data, file->idata, size);
+  memset(file->idata, 0, INLINE_MAX);
+  file->flags &= ~DI_INLINE;
+  file->size = 0;
+  iappend(file, data, size);
+}
+
 void iappend(dinode_t *file, const void *buf, uint32_t size) {
   // append buf to file's data, remember to add file->size
   // you can append block by block
   // TODO();
+  if (file->flags & DI_INLINE) {
+    if (file->size + size <= INLINE_MAX) {
+      memcpy(&file->idata[file->size], buf, size);
+      file->size += size;
+      return;
+    }
+    iunline(file);
+  }
   while(size > 0)
   {
     uint32_t blk_no = file->size / BLK_SIZE, offset = file->size % BLK_SIZE;
@@ -247,3 +373,72 @@ void add_file(char *path) {
   }
   fclose(fp);
 }
+
+// RAID-0 member label, kept in sync with the kernel
+#define RAID_MAGIC 0x30444152
+#define RAID_CHUNK 8 // blocks per chunk
+
+typedef struct {
+  uint32_t magic;
+  uint32_t nmember;
+  uint32_t index;
+  uint32_t chunk;
+  uint32_t nblk;
+} raid_label_t;
+
+void stripe(const char *target, int n) {
+  // the array holds the whole disk, the boot area before the fs is empty
+  // except for the labels, member m starts with array block m * RAID_CHUNK
+  if (n < 2 || n * RAID_CHUNK > BLK_OFF || BLK_NUM % (n * RAID_CHUNK) != 0) panic("bad member count");
+  uint32_t mblk = BLK_NUM / n;
+  for (int m = 0; m < n; ++m) {
+    char path[256];
+    snprintf(path, sizeof path, "%s.%d", target, m);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) panic("open member error");
+    for (uint32_t no = 0; no < mblk; ++no) {
+      uint32_t ano = (no / RAID_CHUNK * n + m) * RAID_CHUNK + no % RAID_CHUNK;
+      blk_t blk;
+      memset(&blk, 0, sizeof blk);
+      if (ano >= BLK_OFF) {
+        blk = *bget(ano);
+      } else if (no == 0) {
+        raid_label_t *lb = (raid_label_t *)&blk;
+        lb->magic = RAID_MAGIC;
+        lb->nmember = n;
+        lb->index = m;
+        lb->chunk = RAID_CHUNK;
+        lb->nblk = BLK_NUM;
+      }
+      if (fwrite(&blk, sizeof blk, 1, fp) != 1) panic("write member error");
+    }
+    fclose(fp);
+  }
+}
+
+static uint32_t namehash(const char *name) {
+  uint32_t h = 2166136261u; // FNV-1a
+  while (*name) h = (h ^ (uint8_t)*name++) * 16777619u;
+  return h;
+}
+
+void index_dir(dinode_t *dir) {
+  if (dir->flags & DI_INLINE) iunline(dir);
+  uint32_t top = balloc();
+  uint32_t *cnt = &bget(top)->u32buf[0];
+  dir->dindex = top;
+  for (uint32_t off = 0; off < dir->size; off += sizeof(dirent_t)) {
+    dirent_t *de = (dirent_t *)&iwalk(dir, off / BLK_SIZE)->u8buf[off % BLK_SIZE];
+    if (de->inode == 0) continue;
+    uint32_t h = namehash(de->name), *bucket = &bget(top)->u32buf[1 + h % IDX_NBUCKET];
+    if (*bucket == 0) *bucket = balloc();
+    uint32_t *b = bget(*bucket)->u32buf;
+    for (; b[0] == IDX_NPAIR; b = bget(b[1])->u32buf) {
+      if (b[1] == 0) b[1] = balloc();
+    }
+    b[2 + b[0] * 2] = h;
+    b[3 + b[0] * 2] = off;
+    b[0]++;
+    (*cnt)++;
+  }
+}